@@ -9,9 +9,25 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <unistd.h>
-#include <windows.h>
 #include <stdbool.h>
+#include <pthread.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+// getTime() uses GetTickCount() on windows and clock_gettime() everywhere else, so benchmarks can run on any host.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#include <sys/select.h> // select() to see if the GUI sent "stop" during a search
+#include <fcntl.h>    // open() for "loadhash"
+#include <sys/mman.h> // mmap() for "loadhash", shm_open() for "SharedHash"
+#include <sys/stat.h> // fstat() for "loadhash" and "SharedHash"
+#endif
+#ifdef __linux__
+#include <sys/syscall.h> // mbind() for the TT, without a dependency on libnuma
+#endif
 
 /******************\
 --------------------
@@ -50,9 +66,53 @@ we will define some essential FEN strings to initialize our board with
 
 #define MATE 32000 // encoding for mating score
 
-#define MAX_TT_SIZE 16777216 // max count of transposition table entries, importantly a power of two so index can be computed with key & ()
+#define DEFAULT_HASH_MB 384 // default size of the transposition table in megabytes, can be changed with the "Hash" UCI option
+
+#define MAX_HASH_MB 65536 // largest transposition table size accepted from the "Hash" UCI option
+#define TT_HEAP 0         // TT allocated with calloc() by initTT()
+#define TT_MMAP 1         // TT mapped from a hash file by "loadhash"
+#define TT_SHM 2          // TT in a named POSIX shared memory segment, "SharedHash" UCI option
+#define TT_ANON 3         // TT in anonymous memory of its own from mmap(), on huge pages when the system has some
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HASH_FILE_VERSION 2 // bump whenever TT_entry, the score encoding or the zobrist numbers change
+
+#define INFINITE_TIME 2147483647 // time limit used when a search is only limited by depth (bench, "go depth", "go infinite")
+
+#define MAX_DEPTH 64 // deepest iteration a depth limited search can ask for
+#define MAX_PLY 128  // deepest ply the search goes, check extensions can take a line past its nominal depth
+#define MATE_BOUND (MATE - MAX_PLY) // scores past this are mates, their distance to the root is MATE - |score| plies
+#define MAX_MULTI_PV 64 // most lines the "MultiPV" option can ask for
+
+#define MAX_THREADS 256 // most threads a parallel perft can use
+
+#define THREAD_STACK_SIZE (32 * 1024 * 1024) // stack size of helper threads, the _Thread_local undo stack is carved out of it on some platforms
+
+#define BENCH_DEFAULT_DEPTH 5 // search depth used by "bench" when none is given
+
+#define TIME_TEST_MOVETIME 1000 // "go movetime" used by "timetest" when none is given
+
+#define BENCH_DEFAULT_HASH_MB 16 // transposition table size used by "bench" when none is given, small so clearing it between positions is cheap
 
 #define TIMEOUT 123456789 // score for timeout
+
+#define TT_MOVE_SCORE 30000 // ordering score of the TT move, above any capture
+#define IIR_MIN_DEPTH 4      // nodes without a TT move are searched one ply shallower from this depth on
+
+#define PROBCUT_MIN_DEPTH 5  // ProbCut is tried from this depth on
+#define SE_MIN_DEPTH 6       // singular extensions are tried from this depth on
+#define SE_TT_DEPTH_MARGIN 3 // the TT entry has to come from a search at most this much shallower
+
+#define SHALLOW_PRUNING_DEPTH 3 // reverse futility pruning, razoring and futility pruning only happen at this depth or below
+
+// null move pruning : reduction = base + depth / divisor + min((static eval - beta) / eval divisor, max eval reduction)
+#define NMP_MIN_DEPTH 3
+#define NMP_BASE_REDUCTION 3
+#define NMP_DEPTH_DIVISOR 4
+#define NMP_EVAL_DIVISOR 200
+#define NMP_MAX_EVAL_REDUCTION 3
+#define NMP_VERIFICATION_DEPTH 6 // null move cutoffs from this depth on are verified by a search without null moves
+
+#define MAX_HISTORY 10000 // capacity of the undo and repetition stacks, enough for a whole game plus the search on top of it
 /*
     The following are encodings for node type of a position encountered during search, stored in a transposition table entry.
     More info on these can be found in the "Transposition Table" section of code.
@@ -147,9 +207,23 @@ enum pieces
     no_piece // no piece on square, I added later into development to help with makeMove().
 };
 
+/*
+A move list entry packs the move and its ordering score into one 32 bit integer : the move in the low 16 bits and the
+signed score in the high 16 bits. Moving a move around while sorting is then a single copy, and a whole list fits in
+about 1 KB, which keeps every recursion level (and every thread stack) small.
+
+256 entries is enough for any pseudo legal move list, the most legal moves known in a position is 218.
+*/
+#define MAX_MOVES 256
+typedef int32_t move_entry_t;
+
+#define makeEntry(move, score) ((move_entry_t)(((uint32_t)(score) << 16) | (move)))
+#define getMove(entry) ((move_t)((entry) & 0xffff))
+#define getScore(entry) ((entry) >> 16) // arithmetic shift, keeps the sign of the score
+
 typedef struct
 {
-    move_t moves[1028];
+    move_entry_t entries[MAX_MOVES];
     int total_count;
 } moves;
 
@@ -334,6 +408,15 @@ U64 bishop_magic_numbers[64] = {
     0x8918844842082200ULL,
     0x4010011029020020ULL};
 
+/*
+The attack tables and zobrist numbers are either filled at startup by initEverything(), or, when compiled with
+-DGENERATED_TABLES, included as const data printed beforehand by the "gentables" command (see the makefile).
+The generated build then has nothing left to compute at startup, the tables are just read-only pages loaded
+from the executable when first touched.
+*/
+#ifdef GENERATED_TABLES
+#include "generated_tables.c"
+#else
 U64 bishop_masks[64];
 
 U64 rook_masks[64];
@@ -341,6 +424,7 @@ U64 rook_masks[64];
 U64 bishop_attacks[64][512];
 
 U64 rook_attacks[64][4096];
+#endif
 /******************\
 --------------------
     BIT BUSINESS
@@ -429,7 +513,9 @@ void printBitboard(U64 bitboard) // helpful debugging function to print a given
 
 // Pawns
 
+#ifndef GENERATED_TABLES
 U64 pawn_attacks[2][64]; // we use [2] for the side to move and [64] for the actual bitboard
+#endif
 
 U64 maskPawnAttacks(int side, int square)
 {
@@ -474,7 +560,9 @@ U64 maskPawnAttacks(int side, int square)
 }
 
 // Knights
+#ifndef GENERATED_TABLES
 U64 knight_attacks[64];
+#endif
 
 U64 maskKnightAttacks(int square)
 {
@@ -503,7 +591,9 @@ U64 maskKnightAttacks(int square)
 }
 
 // Kings
+#ifndef GENERATED_TABLES
 U64 king_attacks[64];
+#endif
 
 U64 maskKingAttacks(int square)
 {
@@ -733,6 +823,7 @@ U64 maskRookAttacksInstant(int square, U64 blockers)
     return attacks;
 }
 // Kings, Pawns, Knights
+#ifndef GENERATED_TABLES
 void initLeaperAttacks()
 {
     // loop all squares
@@ -747,6 +838,7 @@ void initLeaperAttacks()
         king_attacks[square] = maskKingAttacks(square);
     }
 }
+#endif
 
 // Slider Pieces (Bishops, Rooks, Queens!)
 
@@ -884,6 +976,7 @@ void initMagicNumbers()
     }
 }
 
+#ifndef GENERATED_TABLES
 void initSliderAttacks(int bishop)
 {
     for (int square = 0; square < 64; square++)
@@ -926,9 +1019,92 @@ void initSliderAttacks(int bishop)
         }
     }
 }
+#endif
+
+/*
+PEXT (from the BMI2 instruction set) extracts the bits of occupancy selected by the mask and packs them into the low bits
+of the result. Applied to the relevant occupancy mask of a slider, that directly gives a perfect index, so no magic
+multiply and shift is needed, and the attack tables can be densely packed : every square only takes 2^relevant bits entries,
+107648 entries for all squares instead of the 64 * (4096 + 512) the magic tables use.
+
+The backend is chosen at startup by CPUID. The magic path stays as the fallback for CPUs without BMI2, and also for
+AMD CPUs before Zen 3 which do have the instruction but run it in microcode, far slower than a multiply.
+*/
+#ifndef GENERATED_TABLES
+U64 pext_attack_table[107648]; // dense attack table, rook entries first then bishop entries
+
+U64 *rook_pext_attacks[64]; // start of every square's rook entries in pext_attack_table
+
+U64 *bishop_pext_attacks[64]; // start of every square's bishop entries in pext_attack_table
+#endif
+
+bool pext_available = false; // CPU has a fast pext instruction, set by detectPext()
+
+bool use_pext = false; // slider attack lookups use the pext backend, can be turned off with the "UsePEXT" UCI option
+
+static inline U64 pext(U64 source, U64 mask)
+{
+#if defined(__BMI2__)
+    return _pext_u64(source, mask);
+#elif defined(__x86_64__) && defined(__GNUC__)
+    // built without -mbmi2, emit the instruction directly so it can still be used when the CPU supports it
+    U64 result;
+    __asm__("pextq %2, %1, %0" : "=r"(result) : "r"(source), "r"(mask));
+    return result;
+#else
+    (void)source; // never called, use_pext can't be turned on without the instruction
+    (void)mask;
+    return 0;
+#endif
+}
+
+void detectPext() // use CPUID to check for a fast pext instruction
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    pext_available = __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+#else
+    pext_available = false;
+#endif
+}
+
+#ifndef GENERATED_TABLES
+void initPextAttacks() // fill the dense pext attack table, relies on the masks set by initSliderAttacks()
+{
+    U64 *entry = pext_attack_table;
+    for (int square = 0; square < 64; square++)
+    {
+        rook_pext_attacks[square] = entry;
+        int relevant_bits_count = countBits(rook_masks[square]);
+        /*
+        setOccupancy() places bit i of the index on the i-th lowest bit of the mask, which is exactly what pext undoes,
+        so pext(setOccupancy(index)) == index and the variations can be stored in index order.
+        */
+        for (int index = 0; index < (1 << relevant_bits_count); index++)
+        {
+            entry[index] = maskRookAttacksInstant(square, setOccupancy(index, relevant_bits_count, rook_masks[square]));
+        }
+        entry += 1 << relevant_bits_count;
+    }
+    for (int square = 0; square < 64; square++)
+    {
+        bishop_pext_attacks[square] = entry;
+        int relevant_bits_count = countBits(bishop_masks[square]);
+        for (int index = 0; index < (1 << relevant_bits_count); index++)
+        {
+            entry[index] = maskBishopAttacksInstant(square, setOccupancy(index, relevant_bits_count, bishop_masks[square]));
+        }
+        entry += 1 << relevant_bits_count;
+    }
+}
+#endif
 
 static inline U64 genBishopAttacks(U64 occupancy, int square)
 {
+    if (use_pext)
+    {
+        return bishop_pext_attacks[square][pext(occupancy, bishop_masks[square])];
+    }
     occupancy &= bishop_masks[square];
     occupancy *= bishop_magic_numbers[square];
     occupancy >>= 64 - bishop_relevant_bits[square];
@@ -936,6 +1112,10 @@ static inline U64 genBishopAttacks(U64 occupancy, int square)
 }
 static inline U64 genRookAttacks(U64 occupancy, int square)
 {
+    if (use_pext)
+    {
+        return rook_pext_attacks[square][pext(occupancy, rook_masks[square])];
+    }
     occupancy &= rook_masks[square];
     occupancy *= rook_magic_numbers[square];
     occupancy >>= 64 - rook_relevant_bits[square];
@@ -951,28 +1131,38 @@ static inline U64 genQueenAttacks(U64 occupancy, int square)
 Piece Bitboards/Flags
 --------------------
 \******************/
+/*
+Everything describing the current position (and the undo/repetition stacks built on top of it) is _Thread_local.
+Every thread gets its own board, starting out as a copy of these initial values, so perft can walk different parts
+of the tree in parallel while the rest of the code keeps using the position as plain globals.
+The attack tables, zobrist numbers and transposition table stay shared between threads.
+*/
+_Thread_local U64 piece_bitboards[12];
 
-U64 piece_bitboards[12];
-
-U64 occupancy_bitboards[3];
+_Thread_local U64 occupancy_bitboards[3];
 
-int piece_on_square[64]; // an array I implemented later on to use a lookup table for find a piece for making moves.
+_Thread_local int piece_on_square[64]; // an array I implemented later on to use a lookup table for find a piece for making moves.
 
-int side = 0;
+_Thread_local int side = 0;
 
-int en_passant = no_sq;
+_Thread_local int en_passant = no_sq;
 
-int castle = 0;
+_Thread_local int castle = 0;
 
-int half_moves = 0;
+_Thread_local int half_moves = 0;
 
-int full_moves = 0;
+_Thread_local int full_moves = 0;
 
-U64 global_posHash = 0;
+_Thread_local U64 global_posHash = 0;
 
-int repetition[150]; // an array of previously encountered positions to help detect threehold repetiton
+/*
+repetition[] is a stack of the hashes of every position before a move was made, both the game moves sent through
+"position ... moves" and the moves made during search. makeMove() pushes onto it and unmakeMove() pops off it,
+so repetition[repetition_idx - 1] is always the position right before the current one.
+*/
+_Thread_local U64 repetition[MAX_HISTORY];
 
-int repetition_idx = 0; // current index of repetition[150];
+_Thread_local int repetition_idx = 0; // current index of repetition[MAX_HISTORY];
 typedef struct
 {
     U64 piece_bitboards_undo[12];
@@ -986,8 +1176,34 @@ typedef struct
     U64 global_posHash_undo;
 } Undo;
 
-Undo undo_stack[10000]; // create an instance of the struct type defined above
-int undo_stack_count = 0;
+_Thread_local Undo undo_stack[MAX_HISTORY]; // create an instance of the struct type defined above
+_Thread_local int undo_stack_count = 0;
+
+static inline void savePosition(Undo *u) // copy the current position into u, used to push onto the undo stack
+{
+    memcpy(u->piece_bitboards_undo, piece_bitboards, sizeof(piece_bitboards));
+    memcpy(u->occupancy_bitboards_undo, occupancy_bitboards, sizeof(occupancy_bitboards));
+    memcpy(u->piece_on_square_undo, piece_on_square, sizeof(piece_on_square));
+    u->castle_undo = castle;
+    u->en_passant_undo = en_passant;
+    u->full_moves_undo = full_moves;
+    u->half_moves_undo = half_moves;
+    u->side_undo = side;
+    u->global_posHash_undo = global_posHash;
+}
+
+static inline void restorePosition(Undo *u) // make the position saved in u the current position again
+{
+    memcpy(piece_bitboards, u->piece_bitboards_undo, sizeof(piece_bitboards));
+    memcpy(occupancy_bitboards, u->occupancy_bitboards_undo, sizeof(occupancy_bitboards));
+    memcpy(piece_on_square, u->piece_on_square_undo, sizeof(piece_on_square));
+    castle = u->castle_undo;
+    en_passant = u->en_passant_undo;
+    full_moves = u->full_moves_undo;
+    half_moves = u->half_moves_undo;
+    side = u->side_undo;
+    global_posHash = u->global_posHash_undo;
+}
 
 void printBoard()
 {
@@ -1140,7 +1356,7 @@ Right shift to reduce the bits to the proper amount
 void addMove(move_t move, moves *move_list)
 {
 
-    move_list->moves[move_list->total_count] = move;
+    move_list->entries[move_list->total_count] = move; // score 0 until the list is scored for ordering
 
     move_list->total_count++;
 }
@@ -1152,6 +1368,18 @@ void printMoveUCI(move_t move) // print just the UCI-compliant move string (not
 {
     printf("%s%s\n", square_to_coords[getSourceSq(move)], square_to_coords[getTargetSq(move)]);
 }
+void moveToString(move_t move, char *move_string) // write the UCI move string (e.g "e2e4" or "h7h8q") into move_string, which needs room for 6 chars
+{
+    int flags = getFlags(move);
+    if (flags & 0b1000) // promotions encode the piece in the two special bits : knight, bishop, rook, queen
+    {
+        sprintf(move_string, "%s%s%c", square_to_coords[getSourceSq(move)], square_to_coords[getTargetSq(move)], "nbrq"[flags & 0b0011]);
+    }
+    else
+    {
+        sprintf(move_string, "%s%s", square_to_coords[getSourceSq(move)], square_to_coords[getTargetSq(move)]);
+    }
+}
 void printMove(move_t move)
 {
     // print source square of move
@@ -1179,7 +1407,7 @@ void printMoveList(moves *move_list)
     printf("list of moves : [");
     for (int i = 0; i < move_list->total_count; i++)
     {
-        printf(" %d : %s%s, ", i, square_to_coords[getSourceSq(move_list->moves[i])], square_to_coords[getTargetSq(move_list->moves[i])]);
+        printf(" %d : %s%s, ", i, square_to_coords[getSourceSq(getMove(move_list->entries[i]))], square_to_coords[getTargetSq(getMove(move_list->entries[i]))]);
         if (((i + 1) % 17) == 0) // seperate lines every 16 moves
         {
             printf("\n");
@@ -1188,344 +1416,168 @@ void printMoveList(moves *move_list)
     printf("]\n");
 }
 
-static inline void genMoves(moves *move_list)
+/*
+Move generation is written once as a template, genMovesForSide(), with the side to move as a parameter. It is always inlined
+into genWhiteMoves() and genBlackMoves() with a constant side, so the compiler turns every "us == white ? x : y" below into a
+constant : fixed piece indices, shift direction and rank masks, and no side branches left inside the loops. Each instantiation
+only loops over its own six piece types, and genMoves() dispatches once per node.
+
+Moves are generated in the same order as always : pawns, knights, bishops, rooks, queens, castling, then king moves.
+*/
+static inline __attribute__((always_inline)) void genMovesForSide(moves *move_list, const int us)
 {
-    move_list->total_count = 0;
-    int start_square, target_square, double_pawn_push_square, attacked_square;
+    const int them = us ^ 1;
+    const int offset = (us == white) ? P : p;                     // first piece of the side to move in the piece enumeration
+    const int push = (us == white) ? -8 : 8;                      // square offset of a single pawn push
+    const U64 promotion_rank = (us == white) ? seventh_rank : second_rank; // pawns on it promote when they move
+    const U64 double_push_rank = (us == white) ? second_rank : seventh_rank; // pawns on it can push two squares
+    const U64 last_rank = (us == white) ? eighth_rank : first_rank;          // capturing onto it promotes
+
+    const U64 own = occupancy_bitboards[us];
+    const U64 enemy = occupancy_bitboards[them];
+    const U64 occupied = occupancy_bitboards[both];
+
+    int start_square, target_square, attacked_square;
     U64 bitboard, attacks;
-    for (int piece = P; piece <= k; piece++)
+
+    move_list->total_count = 0;
+
+    // generate pawn moves
+    bitboard = piece_bitboards[offset + P];
+    U64 capture_targets = enemy | (en_passant != no_sq ? (1ULL << en_passant) : 0ULL);
+    while (bitboard)
     {
-        bitboard = piece_bitboards[piece];
-        // generating white pawn moves and white king castling
-        if (side == white)
+        start_square = get_lsb_index(bitboard);
+        target_square = start_square + push;
+        if (!((1ULL << target_square) & occupied)) // quiet (non capture) pawn moves
         {
-
-            if (piece == P) // generate pawn moves
+            if ((1ULL << start_square) & promotion_rank)
             {
-                // generate quiet(non capture ) pawn moves
-                while (bitboard)
-                {
-                    start_square = get_lsb_index(bitboard);
-                    target_square = start_square - 8;
-                    double_pawn_push_square = start_square - 16;
-                    if ((1ULL << start_square) & seventh_rank && !((1ULL << target_square) & occupancy_bitboards[both])) // white pawn is on rank 7 and can therefore promote
-                    {
-
-                        move_t knight_promo = encodeMove(start_square, target_square, 1, 0, 0, 0);
-                        move_t bishop_promo = encodeMove(start_square, target_square, 1, 0, 0, 1);
-                        move_t rook_promo = encodeMove(start_square, target_square, 1, 0, 1, 0);
-                        move_t queen_promo = encodeMove(start_square, target_square, 1, 0, 1, 1);
-                        addMove(knight_promo, move_list);
-                        addMove(bishop_promo, move_list);
-                        addMove(rook_promo, move_list);
-                        addMove(queen_promo, move_list);
-                    }
-                    else if ((1ULL << start_square) & second_rank && !((1ULL << target_square) & occupancy_bitboards[both]))
-                    {
-                        // add double pawn push if double push square is not occupied
-                        if (!((1ULL << double_pawn_push_square) & occupancy_bitboards[both]))
-                        {
-                            move_t double_push = encodeMove(start_square, double_pawn_push_square, 0, 0, 0, 1);
-                            addMove(double_push, move_list);
-                        }
-
-                        // add single pawn push
-                        move_t single_push = encodeMove(start_square, target_square, 0, 0, 0, 0);
-                        addMove(single_push, move_list);
-                    }
-                    else if (!((1ULL << target_square) & occupancy_bitboards[both]))
-                    {
-                        move_t single_push = encodeMove(start_square, target_square, 0, 0, 0, 0);
-                        addMove(single_push, move_list);
-                    }
-
-                    attacks = pawn_attacks[white][start_square] & (occupancy_bitboards[black] | (en_passant != no_sq ? (1ULL << en_passant) : 0ULL));
-                    // generate white pawn attacks
-                    while (attacks)
-                    {
-                        attacked_square = get_lsb_index(attacks);
-                        if ((1ULL << attacked_square) & eighth_rank)
-                        {
-                            move_t knight_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 0, 0);
-                            move_t bishop_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 0, 1);
-                            move_t rook_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 1, 0);
-                            move_t queen_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 1, 1);
-                            addMove(knight_promo_capture, move_list);
-                            addMove(bishop_promo_capture, move_list);
-                            addMove(rook_promo_capture, move_list);
-                            addMove(queen_promo_capture, move_list);
-                        }
-                        else if (attacked_square == en_passant)
-                        {
-                            move_t ep_capture = encodeMove(start_square, en_passant, 0, 1, 0, 1);
-                            addMove(ep_capture, move_list);
-                        }
-
-                        else
-                        {
-                            move_t capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                            addMove(capture, move_list);
-                        }
-                        popBit(attacks, attacked_square);
-                    }
-                    popBit(bitboard, start_square);
-                }
+                addMove(encodeMove(start_square, target_square, 1, 0, 0, 0), move_list); // knight promotion
+                addMove(encodeMove(start_square, target_square, 1, 0, 0, 1), move_list); // bishop promotion
+                addMove(encodeMove(start_square, target_square, 1, 0, 1, 0), move_list); // rook promotion
+                addMove(encodeMove(start_square, target_square, 1, 0, 1, 1), move_list); // queen promotion
             }
-            if (piece == K) // generate castling
+            else
             {
-                if (castle & wk)
+                // add double pawn push if double push square is not occupied
+                if (((1ULL << start_square) & double_push_rank) && !((1ULL << (target_square + push)) & occupied))
                 {
-                    if (!getBit(occupancy_bitboards[both], f1) && !(getBit(occupancy_bitboards[both], g1)))
-                    {
-                        if (!isSquareAttacked(e1, black) && !isSquareAttacked(f1, black) && !isSquareAttacked(g1, black))
-                        {
-                            move_t white_kingside_castle = encodeMove(e1, g1, 0, 0, 1, 0);
-                            addMove(white_kingside_castle, move_list);
-                        }
-                    }
-                }
-                if (castle & wq)
-                {
-                    if (!getBit(occupancy_bitboards[both], d1) && !(getBit(occupancy_bitboards[both], c1)) && !(getBit(occupancy_bitboards[both], b1)))
-                    {
-                        if (!isSquareAttacked(e1, black) && !isSquareAttacked(d1, black) && !isSquareAttacked(c1, black) && !isSquareAttacked(b1, black))
-                        {
-                            move_t white_queenside_castle = encodeMove(e1, c1, 0, 0, 1, 1);
-                            addMove(white_queenside_castle, move_list);
-                        }
-                    }
+                    addMove(encodeMove(start_square, target_square + push, 0, 0, 0, 1), move_list);
                 }
+                addMove(encodeMove(start_square, target_square, 0, 0, 0, 0), move_list);
             }
         }
-        else // generating black pawn moves and black king castling moves
+
+        // generate pawn captures, including en-passant
+        attacks = pawn_attacks[us][start_square] & capture_targets;
+        while (attacks)
         {
-            if (piece == p) // generate pawn moves
+            attacked_square = get_lsb_index(attacks);
+            if ((1ULL << attacked_square) & last_rank)
             {
-                // generate quiet(non capture ) pawn moves
-                while (bitboard)
-                {
-                    start_square = get_lsb_index(bitboard);
-                    target_square = start_square + 8;
-                    double_pawn_push_square = start_square + 16;
-                    if ((1ULL << start_square) & second_rank && !((1ULL << target_square) & occupancy_bitboards[both])) // black pawn is on rank 2 and can therefore promote
-                    {
-
-                        move_t knight_promo = encodeMove(start_square, target_square, 1, 0, 0, 0);
-                        move_t bishop_promo = encodeMove(start_square, target_square, 1, 0, 0, 1);
-                        move_t rook_promo = encodeMove(start_square, target_square, 1, 0, 1, 0);
-                        move_t queen_promo = encodeMove(start_square, target_square, 1, 0, 1, 1);
-                        addMove(knight_promo, move_list);
-                        addMove(bishop_promo, move_list);
-                        addMove(rook_promo, move_list);
-                        addMove(queen_promo, move_list);
-                    }
-                    else if ((1ULL << start_square) & seventh_rank && !((1ULL << target_square) & occupancy_bitboards[both])) // black pawn is on second rank and can double push
-                    {
-                        // add double pawn push if double push square is not occupied
-                        if (!((1ULL << double_pawn_push_square) & occupancy_bitboards[both]))
-                        {
-                            move_t double_push = encodeMove(start_square, double_pawn_push_square, 0, 0, 0, 1);
-                            addMove(double_push, move_list);
-                        }
-
-                        // add single pawn push
-                        move_t single_push = encodeMove(start_square, target_square, 0, 0, 0, 0);
-                        addMove(single_push, move_list);
-                    }
-                    else if (!((1ULL << target_square) & occupancy_bitboards[both]))
-                    {
-                        move_t single_push = encodeMove(start_square, target_square, 0, 0, 0, 0);
-                        addMove(single_push, move_list);
-                    }
-
-                    attacks = pawn_attacks[black][start_square] & (occupancy_bitboards[white] | (en_passant != no_sq ? (1ULL << en_passant) : 0ULL));
-                    // generate white pawn attacks
-                    while (attacks)
-                    {
-                        attacked_square = get_lsb_index(attacks);
-                        if ((1ULL << attacked_square) & first_rank) // promo capture
-                        {
-                            move_t knight_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 0, 0);
-                            move_t bishop_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 0, 1);
-                            move_t rook_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 1, 0);
-                            move_t queen_promo_capture = encodeMove(start_square, attacked_square, 1, 1, 1, 1);
-                            addMove(knight_promo_capture, move_list);
-                            addMove(bishop_promo_capture, move_list);
-                            addMove(rook_promo_capture, move_list);
-                            addMove(queen_promo_capture, move_list);
-                        }
-                        else if (attacked_square == en_passant)
-                        {
-                            move_t ep_capture = encodeMove(start_square, en_passant, 0, 1, 0, 1);
-                            addMove(ep_capture, move_list);
-                        }
-
-                        else
-                        {
-                            move_t capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                            addMove(capture, move_list);
-                        }
-                        popBit(attacks, attacked_square);
-                    }
-                    popBit(bitboard, start_square);
-                }
+                addMove(encodeMove(start_square, attacked_square, 1, 1, 0, 0), move_list); // knight promotion capture
+                addMove(encodeMove(start_square, attacked_square, 1, 1, 0, 1), move_list); // bishop promotion capture
+                addMove(encodeMove(start_square, attacked_square, 1, 1, 1, 0), move_list); // rook promotion capture
+                addMove(encodeMove(start_square, attacked_square, 1, 1, 1, 1), move_list); // queen promotion capture
             }
-            if (piece == k) // generate castling
+            else if (attacked_square == en_passant)
             {
-                if (castle & bk)
-                {
-                    if (!getBit(occupancy_bitboards[both], f8) && !(getBit(occupancy_bitboards[both], g8)))
-                    {
-                        if (!isSquareAttacked(e8, white) && !isSquareAttacked(f8, white) && !isSquareAttacked(g8, white))
-                        {
-                            move_t black_kingside_castle = encodeMove(e8, g8, 0, 0, 1, 0);
-                            addMove(black_kingside_castle, move_list);
-                        }
-                    }
-                }
-                if (castle & bq)
-                {
-                    if (!getBit(occupancy_bitboards[both], d8) && !(getBit(occupancy_bitboards[both], c8)) && !(getBit(occupancy_bitboards[both], b8)))
-                    {
-                        if (!isSquareAttacked(e8, white) && !isSquareAttacked(d8, white) && !isSquareAttacked(c8, white) && !isSquareAttacked(b8, white))
-                        {
-                            move_t black_queenside_castle = encodeMove(e8, c8, 0, 0, 1, 1);
-                            addMove(black_queenside_castle, move_list);
-                        }
-                    }
-                }
+                addMove(encodeMove(start_square, en_passant, 0, 1, 0, 1), move_list);
             }
-        }
-        if ((side == white) ? piece == N : piece == n) // gen knight moves
-        {
-            bitboard = (side == white) ? piece_bitboards[N] : piece_bitboards[n];
-            while (bitboard)
+            else
             {
-                start_square = get_lsb_index(bitboard);
-                attacks = knight_attacks[start_square] & ~((side == white) ? occupancy_bitboards[white] : occupancy_bitboards[black]);
-                while (attacks)
-                {
-                    attacked_square = get_lsb_index(attacks);
-                    if ((1ULL << attacked_square) & ((side == white) ? occupancy_bitboards[black] : occupancy_bitboards[white])) // move is a capture
-                    {
-                        move_t knight_capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                        addMove(knight_capture, move_list);
-                    }
-                    else // move is a quiet move
-                    {
-                        move_t knight_move = encodeMove(start_square, attacked_square, 0, 0, 0, 0);
-                        addMove(knight_move, move_list);
-                    }
-                    popBit(attacks, attacked_square);
-                }
-                popBit(bitboard, start_square);
+                addMove(encodeMove(start_square, attacked_square, 0, 1, 0, 0), move_list);
             }
+            popBit(attacks, attacked_square);
         }
-        if ((side == white) ? piece == B : piece == b) // generating bishop moves
+        popBit(bitboard, start_square);
+    }
+
+    // generate knight, bishop, rook and queen moves, the capture bit is set when the target holds an enemy piece
+    for (int piece = offset + N; piece <= offset + Q; piece++)
+    {
+        bitboard = piece_bitboards[piece];
+        while (bitboard)
         {
-            bitboard = (side == white) ? piece_bitboards[B] : piece_bitboards[b];
-            while (bitboard)
+            start_square = get_lsb_index(bitboard);
+            if (piece == offset + N)
+                attacks = knight_attacks[start_square];
+            else if (piece == offset + B)
+                attacks = genBishopAttacks(occupied, start_square);
+            else if (piece == offset + R)
+                attacks = genRookAttacks(occupied, start_square);
+            else
+                attacks = genQueenAttacks(occupied, start_square);
+            attacks &= ~own;
+            while (attacks)
             {
-                start_square = get_lsb_index(bitboard);
-                attacks = genBishopAttacks(occupancy_bitboards[both], start_square) & ~((side == white) ? occupancy_bitboards[white] : occupancy_bitboards[black]);
-                while (attacks)
-                {
-                    attacked_square = get_lsb_index(attacks);
-                    if ((1ULL << attacked_square) & ((side == white) ? occupancy_bitboards[black] : occupancy_bitboards[white]))
-                    {
-                        move_t bishop_capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                        addMove(bishop_capture, move_list);
-                    }
-                    else
-                    {
-                        move_t bishop_move = encodeMove(start_square, attacked_square, 0, 0, 0, 0);
-                        addMove(bishop_move, move_list);
-                    }
-                    popBit(attacks, attacked_square);
-                }
-                popBit(bitboard, start_square);
+                attacked_square = get_lsb_index(attacks);
+                addMove(encodeMove(start_square, attacked_square, 0, ((enemy >> attacked_square) & 1), 0, 0), move_list);
+                popBit(attacks, attacked_square);
             }
+            popBit(bitboard, start_square);
         }
+    }
 
-        if ((side == white) ? piece == R : piece == r) // generating rook moves
+    // generate castling, the king can't start on, pass through, or land on an attacked square
+    const int king_from = (us == white) ? e1 : e8;
+    if (castle & ((us == white) ? wk : bk))
+    {
+        if (!getBit(occupied, king_from + 1) && !getBit(occupied, king_from + 2))
         {
-            bitboard = (side == white) ? piece_bitboards[R] : piece_bitboards[r];
-            while (bitboard)
+            if (!isSquareAttacked(king_from, them) && !isSquareAttacked(king_from + 1, them) && !isSquareAttacked(king_from + 2, them))
             {
-                start_square = get_lsb_index(bitboard);
-                attacks = genRookAttacks(occupancy_bitboards[both], start_square) & ~((side == white) ? occupancy_bitboards[white] : occupancy_bitboards[black]);
-                while (attacks)
-                {
-                    attacked_square = get_lsb_index(attacks);
-                    if ((1ULL << attacked_square) & ((side == white) ? occupancy_bitboards[black] : occupancy_bitboards[white]))
-                    {
-                        move_t rook_capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                        addMove(rook_capture, move_list);
-                    }
-                    else
-                    {
-                        move_t rook_move = encodeMove(start_square, attacked_square, 0, 0, 0, 0);
-                        addMove(rook_move, move_list);
-                    }
-                    popBit(attacks, attacked_square);
-                }
-                popBit(bitboard, start_square);
+                addMove(encodeMove(king_from, king_from + 2, 0, 0, 1, 0), move_list);
             }
         }
-
-        // generating queen moves
-        if ((side == white) ? piece == Q : piece == q)
+    }
+    if (castle & ((us == white) ? wq : bq))
+    {
+        if (!getBit(occupied, king_from - 1) && !getBit(occupied, king_from - 2) && !getBit(occupied, king_from - 3))
         {
-            bitboard = (side == white) ? piece_bitboards[Q] : piece_bitboards[q];
-            while (bitboard)
+            if (!isSquareAttacked(king_from, them) && !isSquareAttacked(king_from - 1, them) && !isSquareAttacked(king_from - 2, them))
             {
-                start_square = get_lsb_index(bitboard);
-                attacks = genQueenAttacks(occupancy_bitboards[both], start_square) & ~((side == white) ? occupancy_bitboards[white] : occupancy_bitboards[black]);
-                while (attacks)
-                {
-                    attacked_square = get_lsb_index(attacks);
-                    if ((1ULL << attacked_square) & ((side == white) ? occupancy_bitboards[black] : occupancy_bitboards[white]))
-                    {
-                        move_t queen_capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                        addMove(queen_capture, move_list);
-                    }
-                    else
-                    {
-                        move_t queen_move = encodeMove(start_square, attacked_square, 0, 0, 0, 0);
-                        addMove(queen_move, move_list);
-                    }
-                    popBit(attacks, attacked_square);
-                }
-                popBit(bitboard, start_square);
+                addMove(encodeMove(king_from, king_from - 2, 0, 0, 1, 1), move_list);
             }
         }
+    }
 
-        // generating king moves
-        if ((side == white) ? piece == K : piece == k)
+    // generate king moves
+    bitboard = piece_bitboards[offset + K];
+    while (bitboard)
+    {
+        start_square = get_lsb_index(bitboard);
+        attacks = king_attacks[start_square] & ~own;
+        while (attacks)
         {
-            bitboard = (side == white) ? piece_bitboards[K] : piece_bitboards[k];
-            while (bitboard)
-            {
-                start_square = get_lsb_index(bitboard);
-                attacks = king_attacks[start_square] & ~((side == white) ? occupancy_bitboards[white] : occupancy_bitboards[black]);
-                while (attacks)
-                {
-                    attacked_square = get_lsb_index(attacks);
-                    if ((1ULL << attacked_square) & ((side == white) ? occupancy_bitboards[black] : occupancy_bitboards[white]))
-                    {
-                        move_t king_capture = encodeMove(start_square, attacked_square, 0, 1, 0, 0);
-                        addMove(king_capture, move_list);
-                    }
-                    else
-                    {
-                        move_t king_move = encodeMove(start_square, attacked_square, 0, 0, 0, 0);
-                        addMove(king_move, move_list);
-                    }
-                    popBit(attacks, attacked_square);
-                }
-                popBit(bitboard, start_square);
-            }
+            attacked_square = get_lsb_index(attacks);
+            addMove(encodeMove(start_square, attacked_square, 0, ((enemy >> attacked_square) & 1), 0, 0), move_list);
+            popBit(attacks, attacked_square);
         }
+        popBit(bitboard, start_square);
+    }
+}
+
+static void genWhiteMoves(moves *move_list)
+{
+    genMovesForSide(move_list, white);
+}
+
+static void genBlackMoves(moves *move_list)
+{
+    genMovesForSide(move_list, black);
+}
+
+static inline void genMoves(moves *move_list)
+{
+    if (side == white)
+    {
+        genWhiteMoves(move_list);
+    }
+    else
+    {
+        genBlackMoves(move_list);
     }
 }
 /******************\
@@ -1577,6 +1629,7 @@ if(there is an en_passant) then posHash ^= zobristNums[785+(en_passant % 8)] //m
 const int ZOBRIST_BLK_TO_PLAY_IDX = 768;
 const int ZOBRIST_CASTLE_IDX = 769;
 const int ZOBRIST_EP_IDX = 785;
+#ifndef GENERATED_TABLES
 U64 zobristNums[793];
 
 void initZobristNums()
@@ -1586,6 +1639,7 @@ void initZobristNums()
         zobristNums[index] = genRandomNumberU64();
     }
 }
+#endif
 
 U64 genPositionHash()
 {
@@ -1635,77 +1689,607 @@ For the transposition table, an entry will store the following information :
     transposition table, the entry will be replaced if the entries depth is lower than the depth of the new entry.
 
     I decided on this implementation as it would cut out shallow-depth nodes and keep those with higher depth and therefore higher evaluation accuracy.
+
+    The replacement has two exceptions : an entry left by an earlier search (an older age) is always replaced, otherwise deep
+    entries from moves long played would fill the table forever, and a new entry at most 2 plies shallower also replaces
+    one, since it is fresher and its bound often fits the window better. Overwriting on every collision, which is what the
+    table used to do, let the qsearch entries wipe out the deep ones, and with them the TT moves that IIR relies on.
 */
 
+/*
+An entry is two 64 bit words, like the perft hash : the fields packed into data, and the key stored XORed with data. The
+table can be shared between processes (see "SharedHash"), and two of them writing the same entry at once can leave the
+key of one with the data of the other. The key check of probeTT() then fails, so a torn entry is a miss, never a wrong
+score, and no lock is needed.
+*/
 typedef struct
 {
-    U64 key;        // zobrist key of position
+    U64 key;  // zobrist key of position XOR data
+    U64 data; // best move | age << 16 | depth << 32 | eval << 40 | node type << 56, see packTTdata()
+} TT_entry;
+
+typedef struct // an entry unpacked by probeTT()
+{
     move_t topMove; // best move found
+    int age;        // tt_age of the search which stored it
     int depth;      // search depth
     int eval;       // score of position
     int node_type;  // type of node, 0 for exact, 1 for cut-node, and 2 for all-node
-} TT_entry;
+} TT_data;
 
-TT_entry TT[MAX_TT_SIZE]; // placeholder of 2 for size currently, will be set to TT_size when transposition table implementation is done.s
+static inline U64 packTTdata(move_t topMove, int age, int depth, int eval, int node_type)
+{
+    return (U64)topMove | (U64)(uint16_t)age << 16 | (U64)(uint8_t)depth << 32 | (U64)(uint16_t)eval << 40 |
+           (U64)node_type << 56;
+}
 
-TT_entry *probeTT(U64 key) // function which will be used to check if a position encountered during search is already stored in our TT
+static inline TT_data unpackTTdata(U64 data)
 {
-    int index = key & (MAX_TT_SIZE - 1); // faster alternative to the % operator under the condition TT_SIZE is a power of two
-    if (TT[index].key == key)
-    { // check for key equality at index
-        return &TT[index];
-    }
-    return NULL; // if probe returns nothing, return a NULL pointer
+    TT_data unpacked;
+    unpacked.topMove = (move_t)(data & 0xFFFF);
+    unpacked.age = (int)((data >> 16) & 0xFFFF);
+    unpacked.depth = (int)((data >> 32) & 0xFF);
+    unpacked.eval = (int16_t)((data >> 40) & 0xFFFF); // scores fit in 16 bits, mates are at most MATE
+    unpacked.node_type = (int)((data >> 56) & 0x3);
+    return unpacked;
 }
 
-void storeTTentry(U64 key, move_t topMove, int depth, int eval, int node_type)
+TT_entry *TT = NULL; // the transposition table itself, allocated by initTT() so its size can be changed with the "Hash" UCI option
+U64 tt_size = 0;     // count of entries in TT, importantly a power of two so index can be computed with key & (tt_size - 1)
+int hash_megabytes = DEFAULT_HASH_MB; // "Hash" UCI option, the size setupTT() allocates
+char shared_hash_name[256] = "";      // "SharedHash" UCI option, empty for a table of our own
+int tt_alloc_kind = TT_HEAP; // how TT was obtained, so freeTT() knows how to give it back
+void *tt_mapping = NULL;     // start of the mapping when TT comes from mmap(), for TT_MMAP the table starts after the file header
+size_t tt_mapping_size = 0;
+char tt_pages[64] = "4K pages";  // what initTT() obtained, reported by printTTInfo()
+char tt_numa[64] = "single node"; // NUMA placement of the table
+uint16_t tt_age = 0;  // incremented by every search, entries with another age are from an older one
+uint16_t *tt_shared_age = NULL; // age word in the header of a shared table, every process sharing it advances that one
+int tt_age_window = 0;          // entries at most this many searches older than tt_age still count as current
+
+void freeTT() // release the table whichever way it was obtained
 {
-    int index = key & (MAX_TT_SIZE - 1);
-    if (TT[index].key == 0) // keys should be zero initialized so this is a working check for an empty entry
+#ifndef _WIN32
+    if (tt_alloc_kind == TT_MMAP || tt_alloc_kind == TT_SHM || tt_alloc_kind == TT_ANON)
     {
-        TT[index].key = key;
-        TT[index].topMove = topMove;
-        TT[index].depth = depth;
-        TT[index].eval = eval;
-        TT[index].node_type = node_type;
+        munmap(tt_mapping, tt_mapping_size); // a shared segment stays, for the other processes and the next one
     }
-    else if (depth > TT[index].depth || TT[index].key != key) // overwrite an entry if a collision occurs or search depth of new entry is greater
+    else
+#endif
     {
-        TT[index].key = key;
-        TT[index].topMove = topMove;
-        TT[index].depth = depth;
-        TT[index].eval = eval;
-        TT[index].node_type = node_type;
+        free(TT);
     }
+    TT = NULL;
+    tt_mapping = NULL;
+    tt_mapping_size = 0;
+    tt_alloc_kind = TT_HEAP;
+    tt_shared_age = NULL;
+    tt_age_window = 0;
 }
 
-move_t pv[60];
-int pv_size = 0;
-/******************\
---------------------
-   Make/Unmake Moves
---------------------
-\******************/
 /*
-In this code section, functions will be created for making and unmaking moves on the board so we can later implement them within the
-search function. Additionaly, helper functions will be created for use within makeMove().
+The TT is probed at random, so with 4K pages nearly every probe misses the TLB. On Linux initTT() asks for 2 MB pages :
 
-9.10.25 Update - makeMove() will be updated to also edit the global position hash key.
+    - MAP_HUGETLB first, pages reserved by the administrator (vm.nr_hugepages), always huge when there are enough
+    - otherwise a plain anonymous mapping aligned to 2 MB with madvise(MADV_HUGEPAGE), transparent huge pages the kernel
+      hands out when it can (transparent_hugepage set to "madvise" or "always")
+    - calloc() and 4K pages everywhere else, and when both fail
+
+On a machine with several NUMA nodes, the pages are interleaved over all of them with mbind(). The search thread then
+gets the same average latency wherever it runs, and the perft threads share the memory bandwidth of every node. Without
+it, first touch puts the whole table on the node of the thread that cleared it. "info string" reports what was obtained.
 */
+#ifdef __linux__
+void interleaveOnNodes(void *memory, size_t size) // spread the pages of memory over every online NUMA node
+{
+    FILE *file = fopen("/sys/devices/system/node/online", "r"); // like "0" or "0-3" or "0,2-3"
+    if (file == NULL)
+        return;
+    unsigned long node_mask = 0;
+    int node_count = 0, first, last;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        if (fscanf(file, "-%d", &last) != 1)
+            last = first;
+        for (int node = first; node <= last && node < 64; node++)
+        {
+            node_mask |= 1UL << node;
+            node_count++;
+        }
+        if (fgetc(file) != ',')
+            break;
+    }
+    fclose(file);
+    if (node_count < 2)
+        return;
+    const int MPOL_INTERLEAVE_MODE = 3; // MPOL_INTERLEAVE from <numaif.h>
+    if (syscall(SYS_mbind, memory, size, MPOL_INTERLEAVE_MODE, &node_mask, 64, 0) == 0)
+        snprintf(tt_numa, sizeof(tt_numa), "interleaved over %d NUMA nodes", node_count);
+    else
+        snprintf(tt_numa, sizeof(tt_numa), "first touch, mbind failed on %d NUMA nodes", node_count);
+}
+#endif
 
-static inline int isIllegalPosition() // helper function to check if current board position is illegal.
+void printTTInfo()
 {
+    printf("info string hash %llu MB, %s, %s\n", (unsigned long long)(tt_size * sizeof(TT_entry) / (1024 * 1024)), tt_pages,
+           tt_numa);
+    fflush(stdout);
+}
 
-    if (!countBits(piece_bitboards[K]) || !countBits(piece_bitboards[k]))
+void initTT(int megabytes) // (re)allocate the transposition table with the largest power of two entry count fitting in megabytes
+{
+    U64 entries = 1;
+    while (entries * 2 * sizeof(TT_entry) <= (U64)megabytes * 1024 * 1024)
     {
-        return 1;
+        entries *= 2;
     }
-    // check whether king was left in check
-    // recall this is called after makeMove flips side, so if white just moved, side==black.
-    // if white moves, side==black, square = white king square, isSquareAttacked checks if black attacks white king and its blacks turn.
-    // this means we need to make sure it is not our turn and we can capture the enemy king, that would be illegal.
-    //
-    int enemyKingSquare = (side == white) ? get_lsb_index(piece_bitboards[k]) : get_lsb_index(piece_bitboards[K]);
+    freeTT();
+    size_t size = entries * sizeof(TT_entry);
+    snprintf(tt_numa, sizeof(tt_numa), "single node");
+#ifdef __linux__
+    // anonymous mappings are zero filled, which is how an empty entry is recognized in storeTTentry()
+    size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    void *mapping = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapping != MAP_FAILED)
+    {
+        tt_mapping_size = huge_size;
+        snprintf(tt_pages, sizeof(tt_pages), "2M huge pages (MAP_HUGETLB)");
+    }
+    else
+    {
+        // map one huge page more than needed so the table can start on a 2 MB boundary, then give back the slack
+        size_t padded_size = huge_size + HUGE_PAGE_SIZE;
+        char *padded = mmap(NULL, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (padded != MAP_FAILED)
+        {
+            char *aligned = (char *)(((uintptr_t)padded + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned > padded)
+                munmap(padded, aligned - padded);
+            if (padded + padded_size > aligned + huge_size)
+                munmap(aligned + huge_size, padded + padded_size - (aligned + huge_size));
+            mapping = aligned;
+            tt_mapping_size = huge_size;
+            if (madvise(mapping, huge_size, MADV_HUGEPAGE) == 0)
+                snprintf(tt_pages, sizeof(tt_pages), "transparent huge pages (madvise)");
+            else
+                snprintf(tt_pages, sizeof(tt_pages), "4K pages, madvise failed");
+        }
+    }
+    if (mapping != MAP_FAILED)
+    {
+        interleaveOnNodes(mapping, tt_mapping_size);
+        TT = mapping;
+        tt_mapping = mapping;
+        tt_alloc_kind = TT_ANON;
+        tt_size = entries;
+        return;
+    }
+#endif
+    // calloc() zero initializes the keys, which is how an empty entry is recognized in storeTTentry()
+    TT = calloc(entries, sizeof(TT_entry));
+    if (TT == NULL)
+    {
+        fprintf(stderr, "failed to allocate %d MB for the transposition table\n", megabytes);
+        exit(1);
+    }
+    snprintf(tt_pages, sizeof(tt_pages), "4K pages");
+    tt_size = entries;
+}
+
+/*
+With the "SharedHash" option the table lives in a named POSIX shared memory segment (/dev/shm/<name> on Linux) instead
+of our own memory. lichess-bot starts one engine per game, and every engine given the same name maps the same table, so
+N games use one table instead of N, and a position analyzed by one game is a hit in the others. Entries are lockless
+(see TT_entry), so no locking is needed between the processes.
+
+The first process creates the segment with its "Hash" size, the ones after it take whatever size it has. The segment
+outlives the engines, which is what keeps it warm between games. Removing /dev/shm/<name> frees it.
+
+The segment starts with a SHARED_TT_HEADER_SIZE header holding the search age, and the entries follow. Every process takes
+the age of its next search from that word, so the ages of all the processes count together. Since the others keep
+searching too, an entry of a search running in another process can be a few ages behind ours : with a shared table
+entries up to SHARED_TT_AGE_WINDOW ages old still count as current, instead of being overwritten as if a previous search
+had left them.
+*/
+#define SHARED_TT_HEADER_SIZE 64 // keeps the entries on a cache line boundary
+#define SHARED_TT_AGE_WINDOW 8   // about the number of engines expected to search a shared table at once
+bool initSharedTT(const char *name, int megabytes)
+{
+#ifdef _WIN32
+    printf("info string SharedHash needs POSIX shared memory, using a table of our own\n");
+    return false;
+#else
+    U64 entries = 1;
+    while (entries * 2 * sizeof(TT_entry) <= (U64)megabytes * 1024 * 1024)
+    {
+        entries *= 2;
+    }
+    size_t size = SHARED_TT_HEADER_SIZE + entries * sizeof(TT_entry);
+    bool created = true;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        created = false; // someone else created it, attach to theirs
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        printf("info string can't open shared memory %s, using a table of our own\n", name);
+        return false;
+    }
+    struct stat segment;
+    if (created)
+    {
+        if (ftruncate(fd, size) != 0) // new segments are zero filled, which is an empty table and age 0
+        {
+            close(fd);
+            shm_unlink(name);
+            printf("info string can't size shared memory %s, using a table of our own\n", name);
+            return false;
+        }
+    }
+    else
+    {
+        // the creator may not have sized it yet
+        for (int tries = 0; tries < 1000 && fstat(fd, &segment) == 0 && segment.st_size == 0; tries++)
+        {
+            usleep(1000);
+        }
+        size = (fstat(fd, &segment) == 0) ? (size_t)segment.st_size : 0;
+        entries = (size > SHARED_TT_HEADER_SIZE) ? (size - SHARED_TT_HEADER_SIZE) / sizeof(TT_entry) : 0;
+        if (entries == 0 || (entries & (entries - 1)) != 0 || SHARED_TT_HEADER_SIZE + entries * sizeof(TT_entry) != size)
+        {
+            close(fd);
+            printf("info string shared memory %s is not a table of this version, using a table of our own\n", name);
+            return false;
+        }
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the segment open
+    if (mapping == MAP_FAILED)
+    {
+        printf("info string can't map shared memory %s, using a table of our own\n", name);
+        return false;
+    }
+    freeTT();
+    snprintf(tt_pages, sizeof(tt_pages), "shared memory");
+    snprintf(tt_numa, sizeof(tt_numa), "single node");
+#ifdef __linux__
+    interleaveOnNodes(mapping, size);
+#endif
+    TT = (TT_entry *)((char *)mapping + SHARED_TT_HEADER_SIZE);
+    tt_mapping = mapping;
+    tt_mapping_size = size;
+    tt_alloc_kind = TT_SHM;
+    tt_size = entries;
+    tt_shared_age = (uint16_t *)mapping;
+    tt_age_window = SHARED_TT_AGE_WINDOW;
+    printf("info string %s shared table %s, %llu MB\n", created ? "created" : "attached to", name,
+           (unsigned long long)(entries * sizeof(TT_entry) / (1024 * 1024)));
+    return true;
+#endif
+}
+
+void setupTT() // the table the UCI options ask for, shared or our own
+{
+    if (shared_hash_name[0] == '\0' || !initSharedTT(shared_hash_name, hash_megabytes))
+    {
+        initTT(hash_megabytes);
+    }
+}
+
+/*
+bench and the suites search on a small table of their own, cleared before every position, so their node counts never
+depend on what the GUI's table holds, and clearing never wipes a shared table for the other engines. The GUI's table,
+whichever way it was obtained (our own, shared, or mapped by "loadhash"), is put aside meanwhile and given back untouched
+afterwards, so a warm cache survives them.
+*/
+typedef struct
+{
+    TT_entry *table;
+    U64 size;
+    int alloc_kind;
+    void *mapping;
+    size_t mapping_size;
+    char pages[64];
+    char numa[64];
+    uint16_t age;
+    uint16_t *shared_age;
+    int age_window;
+} tt_state;
+
+tt_state set_aside_tt; // the GUI's table while setAsideTT() is in effect
+
+void setAsideTT(int megabytes) // keep the current table for restoreTT() and allocate a new one of megabytes
+{
+    set_aside_tt = (tt_state){TT, tt_size, tt_alloc_kind, tt_mapping, tt_mapping_size, "", "", tt_age, tt_shared_age, tt_age_window};
+    memcpy(set_aside_tt.pages, tt_pages, sizeof(tt_pages));
+    memcpy(set_aside_tt.numa, tt_numa, sizeof(tt_numa));
+    // detach it so initTT() doesn't free it
+    TT = NULL;
+    tt_size = 0;
+    tt_alloc_kind = TT_HEAP;
+    tt_mapping = NULL;
+    tt_mapping_size = 0;
+    tt_shared_age = NULL;
+    tt_age_window = 0;
+    initTT(megabytes);
+}
+
+void restoreTT() // free the table of setAsideTT() and go back to the one it kept
+{
+    freeTT();
+    TT = set_aside_tt.table;
+    tt_size = set_aside_tt.size;
+    tt_alloc_kind = set_aside_tt.alloc_kind;
+    tt_mapping = set_aside_tt.mapping;
+    tt_mapping_size = set_aside_tt.mapping_size;
+    memcpy(tt_pages, set_aside_tt.pages, sizeof(tt_pages));
+    memcpy(tt_numa, set_aside_tt.numa, sizeof(tt_numa));
+    tt_age = set_aside_tt.age;
+    tt_shared_age = set_aside_tt.shared_age;
+    tt_age_window = set_aside_tt.age_window;
+}
+
+void clearTT() // forget every stored position, used between bench positions so every search starts from the same state
+{
+    memset(TT, 0, tt_size * sizeof(TT_entry));
+}
+
+/*
+Mate scores are relative to the root : -MATE + ply means mated ply plies from the root. The same position can be reached at
+another ply though, so a mate is stored as its distance from the node itself and turned back into a distance from the root
+when it is probed. Without that, a mate found at ply 7 and read back at ply 3 would claim to be 4 plies shorter than it is.
+*/
+static inline int scoreToTT(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score + ply;
+    if (score < -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+static inline int scoreFromTT(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score - ply;
+    if (score < -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+// TT statistics of the current search, printed once it is done
+long long tt_probes = 0;    // lookups
+long long tt_hits = 0;      // lookups that found the position
+long long tt_cutoffs = 0;   // hits deep enough and with the right bound to return their score right away
+long long tt_move_hits = 0; // hits with a best move to search first
+
+bool probeTT(U64 key, TT_data *hit) // function which will be used to check if a position encountered during search is already stored in our TT
+{
+    U64 index = key & (tt_size - 1); // faster alternative to the % operator under the condition tt_size is a power of two
+    tt_probes++;
+    U64 data = TT[index].data; // read once, another process may be writing the entry
+    if ((TT[index].key ^ data) == key)
+    { // check for key equality at index
+        tt_hits++;
+        *hit = unpackTTdata(data);
+        return true;
+    }
+    return false;
+}
+
+/*
+Whether a stored score answers the search with this window : an exact score always does, a lower bound (cut-node) only
+when it is at least beta, and an upper bound (all-node) only when it is at most alpha. Otherwise the node has to be searched
+and the entry is only good for its move.
+*/
+static inline bool ttScoreUsable(int node_type, int eval, int alpha, int beta)
+{
+    switch (node_type)
+    {
+    case PV_NODE:
+        return true;
+    case CUT_NODE:
+        return eval >= beta;
+    case ALL_NODE:
+        return eval <= alpha;
+    }
+    return false;
+}
+
+int hashFull() // permille of the TT in use, estimated on the first 1000 entries like UCI "hashfull" expects
+{
+    U64 sample = (tt_size < 1000) ? tt_size : 1000;
+    int used = 0;
+    for (U64 i = 0; i < sample; i++)
+    {
+        if (TT[i].key != 0 || TT[i].data != 0)
+            used++;
+    }
+    return (int)(used * 1000 / sample);
+}
+
+void storeTTentry(U64 key, move_t topMove, int depth, int eval, int node_type, int ply) // eval is relative to the root, ply is the node's
+{
+    U64 index = key & (tt_size - 1);
+    eval = scoreToTT(eval, ply);
+    U64 old_data = TT[index].data;
+    U64 old_key = TT[index].key ^ old_data;
+    TT_data old = unpackTTdata(old_data);
+    // entries are zero initialized so both words 0 is an empty entry. the age difference is signed : with a shared table
+    // another process may already be a search ahead of us, and its entries are as current as ours
+    bool old_search = (int16_t)(tt_age - old.age) > tt_age_window;
+    if ((TT[index].key == 0 && old_data == 0) || old_search || depth >= old.depth - 2)
+    {
+        if (!topMove && old_key == key) // a fail low has no move of its own, keep the one found before for ordering
+            topMove = old.topMove;
+        U64 data = packTTdata(topMove, tt_age, depth, eval, node_type);
+        TT[index].key = key ^ data;
+        TT[index].data = data;
+    }
+}
+
+/******************\
+--------------------
+   Hash Files
+--------------------
+\******************/
+/*
+"savehash <file>" dumps the transposition table to disk and "loadhash <file>" brings it back, so an analysis cache can
+survive a restart or be copied to another host. The file is a 64 byte header followed by the entries exactly as they are
+in memory :
+
+    - magic "SJHASH" and HASH_FILE_VERSION, bumped whenever an entry or the score encoding changes
+    - sizeof(TT_entry) and the entry count, a power of two
+    - a checksum of the zobrist numbers, since keys made with other numbers would never match
+
+The entries are written in the host's byte order, so a file only moves between hosts of the same architecture.
+Loading maps the file with mmap() instead of reading it : a big table is ready right away and pages come in as they are
+probed. The mapping is private, searching writes to copies of the pages and the file itself never changes. Windows has no
+mmap(), there the file is read into a calloc()'d table. The table keeps the file's size until the next "Hash" or
+"SharedHash" option, bench and the suites set it aside and give it back (see setAsideTT()).
+
+Saving goes through a temporary file renamed over the target. Truncating the file that is currently mapped would
+make the untouched pages of the table vanish under the search.
+*/
+typedef struct
+{
+    char magic[8];          // "SJHASH"
+    uint32_t version;       // HASH_FILE_VERSION
+    uint32_t entry_size;    // sizeof(TT_entry) of the engine which wrote it
+    uint64_t entry_count;   // number of entries following the header
+    uint64_t zobrist_check; // XOR of every zobrist number
+    char reserved[32];      // pads the header to 64 bytes, so the entries stay aligned in the mapping
+} hash_file_header;
+
+U64 zobristCheck()
+{
+    U64 check = 0;
+    for (int index = 0; index < 793; index++)
+    {
+        check ^= zobristNums[index] * (index + 1); // the multiplication makes swapped numbers change the checksum too
+    }
+    return check;
+}
+
+bool saveHash(const char *file_name)
+{
+    char temp_name[1100];
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name);
+    FILE *file = fopen(temp_name, "wb");
+    if (file == NULL)
+    {
+        printf("info string can't open %s for writing\n", temp_name);
+        return false;
+    }
+    hash_file_header header = {"SJHASH", HASH_FILE_VERSION, sizeof(TT_entry), tt_size, zobristCheck(), {0}};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(TT, sizeof(TT_entry), tt_size, file) == tt_size;
+    written = (fclose(file) == 0) && written;
+    if (!written || rename(temp_name, file_name) != 0)
+    {
+        remove(temp_name);
+        printf("info string failed to write %s\n", file_name);
+        return false;
+    }
+    printf("info string saved %llu entries to %s\n", (unsigned long long)tt_size, file_name);
+    return true;
+}
+
+bool loadHash(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+    {
+        printf("info string can't open %s\n", file_name);
+        return false;
+    }
+    hash_file_header header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1;
+    valid = valid && memcmp(header.magic, "SJHASH", 7) == 0 && header.version == HASH_FILE_VERSION &&
+            header.entry_size == sizeof(TT_entry) && header.zobrist_check == zobristCheck();
+    valid = valid && header.entry_count > 0 && (header.entry_count & (header.entry_count - 1)) == 0 &&
+            header.entry_count <= (uint64_t)MAX_HASH_MB * 1024 * 1024 / sizeof(TT_entry);
+    size_t file_size = sizeof(header) + header.entry_count * sizeof(TT_entry);
+    if (valid) // the size has to match the header exactly, a truncated copy would be read past its end
+    {
+        valid = fseek(file, 0, SEEK_END) == 0 && ftell(file) == (long)file_size;
+    }
+    if (!valid)
+    {
+        fclose(file);
+        printf("info string %s is not a hash file of this version, table left unchanged\n", file_name);
+        return false;
+    }
+
+#ifdef _WIN32
+    TT_entry *table = calloc(header.entry_count, sizeof(TT_entry));
+    bool loaded = table != NULL && fseek(file, sizeof(header), SEEK_SET) == 0 &&
+                  fread(table, sizeof(TT_entry), header.entry_count, file) == header.entry_count;
+    fclose(file);
+    if (!loaded)
+    {
+        free(table);
+        printf("info string failed to read %s, table left unchanged\n", file_name);
+        return false;
+    }
+    freeTT();
+    TT = table;
+    snprintf(tt_pages, sizeof(tt_pages), "4K pages");
+#else
+    fclose(file);
+    int fd = open(file_name, O_RDONLY);
+    void *mapping = (fd < 0) ? MAP_FAILED : mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (fd >= 0)
+    {
+        close(fd); // the mapping keeps the file alive
+    }
+    if (mapping == MAP_FAILED)
+    {
+        printf("info string failed to map %s, table left unchanged\n", file_name);
+        return false;
+    }
+    freeTT();
+    tt_mapping = mapping;
+    tt_mapping_size = file_size;
+    tt_alloc_kind = TT_MMAP;
+    snprintf(tt_pages, sizeof(tt_pages), "mapped from %.40s", file_name);
+    snprintf(tt_numa, sizeof(tt_numa), "single node");
+    TT = (TT_entry *)((char *)mapping + sizeof(header));
+#endif
+    tt_size = header.entry_count;
+    printf("info string loaded %llu entries from %s (%s)\n", (unsigned long long)tt_size, file_name,
+           tt_alloc_kind == TT_MMAP ? "mmap" : "read");
+    return true;
+}
+
+/******************\
+--------------------
+   Make/Unmake Moves
+--------------------
+\******************/
+/*
+In this code section, functions will be created for making and unmaking moves on the board so we can later implement them within the
+search function. Additionaly, helper functions will be created for use within makeMove().
+
+9.10.25 Update - makeMove() will be updated to also edit the global position hash key.
+*/
+
+static inline int isIllegalPosition() // helper function to check if current board position is illegal.
+{
+
+    if (!countBits(piece_bitboards[K]) || !countBits(piece_bitboards[k]))
+    {
+        return 1;
+    }
+    // check whether king was left in check
+    // recall this is called after makeMove flips side, so if white just moved, side==black.
+    // if white moves, side==black, square = white king square, isSquareAttacked checks if black attacks white king and its blacks turn.
+    // this means we need to make sure it is not our turn and we can capture the enemy king, that would be illegal.
+    //
+    int enemyKingSquare = (side == white) ? get_lsb_index(piece_bitboards[k]) : get_lsb_index(piece_bitboards[K]);
     if (isSquareAttacked(enemyKingSquare, side))
     {
         return 1;
@@ -1724,16 +2308,10 @@ static inline void unmakeMove()
     //  it will overwrite the used entry.
 
     Undo *u = &undo_stack[--undo_stack_count];
+    // pop the hash of the position we are returning to off the repetition stack
+    repetition_idx--;
     // init saved game state data into global game state variables
-    memcpy(piece_bitboards, u->piece_bitboards_undo, sizeof(piece_bitboards));
-    memcpy(occupancy_bitboards, u->occupancy_bitboards_undo, sizeof(occupancy_bitboards));
-    memcpy(piece_on_square, u->piece_on_square_undo, sizeof(piece_on_square));
-    castle = u->castle_undo;
-    en_passant = u->en_passant_undo;
-    full_moves = u->full_moves_undo;
-    half_moves = u->half_moves_undo;
-    side = u->side_undo;
-    global_posHash = u->global_posHash_undo;
+    restorePosition(u);
 }
 static inline int makeMove(move_t move)
 {
@@ -1759,15 +2337,9 @@ static inline int makeMove(move_t move)
     // push undo struct onto stack
 
     Undo *u = &undo_stack[undo_stack_count++];
-    memcpy(u->piece_bitboards_undo, piece_bitboards, sizeof(piece_bitboards));
-    memcpy(u->occupancy_bitboards_undo, occupancy_bitboards, sizeof(occupancy_bitboards));
-    memcpy(u->piece_on_square_undo, piece_on_square, sizeof(piece_on_square));
-    u->castle_undo = castle;
-    u->en_passant_undo = en_passant;
-    u->full_moves_undo = full_moves;
-    u->half_moves_undo = half_moves;
-    u->side_undo = side;
-    u->global_posHash_undo = global_posHash;
+    savePosition(u);
+    // push hash of position before the move onto the repetition stack
+    repetition[repetition_idx++] = global_posHash;
 
     // update piece bitboards according to move
     if (piece_on_square[to] != no_piece) // move is a capture, need to pop bit from opposing side piece and occupancy bitboard
@@ -2005,17 +2577,17 @@ static inline int makeMove(move_t move)
     global_posHash ^= zobristNums[ZOBRIST_CASTLE_IDX + castle]; // after castling rights changes
     // update en passant
 
+    if (en_passant != no_sq)
+    {
+        global_posHash ^= zobristNums[ZOBRIST_EP_IDX + (en_passant % 8)]; // remove en_passant file from hash
+        en_passant = no_sq;
+    }
     if ((piece == P || piece == p) && (flags == 0b0001))
     {
 
         en_passant = (side == white) ? from - 8 : from + 8;
         global_posHash ^= zobristNums[ZOBRIST_EP_IDX + (en_passant % 8)]; // add en_passant file to hash
     }
-    else if (en_passant != no_sq)
-    {
-        global_posHash ^= zobristNums[ZOBRIST_EP_IDX + (en_passant % 8)]; // remove en_passant file from hash
-        en_passant = no_sq;
-    }
 
     // update fullmoves
     if (side == black)
@@ -2046,38 +2618,59 @@ static inline int makeMove(move_t move)
     return 1;
 }
 
-static inline void makeNullMove() // a function to make null moves, to later implement null move pruning.
+/*
+A null move passes the turn. Besides flipping the side to move it has to clear the en-passant square, since the capture
+is only possible right after the double push, and reset the fifty move counter, since the repetition scan must not look
+past a null move. NullUndo keeps what has to be put back, which is a lot less than a full Undo.
+*/
+typedef struct
 {
+    int en_passant;
+    int half_moves;
+    U64 hash;
+} NullUndo;
 
+static inline void makeNullMove(NullUndo *u)
+{
+    u->en_passant = en_passant;
+    u->half_moves = half_moves;
+    u->hash = global_posHash;
+    if (en_passant != no_sq)
+    {
+        global_posHash ^= zobristNums[ZOBRIST_EP_IDX + (en_passant % 8)]; // remove en_passant file from hash
+        en_passant = no_sq;
+    }
+    half_moves = 0;
     side ^= 1;                                              // flip side to move
     global_posHash ^= zobristNums[ZOBRIST_BLK_TO_PLAY_IDX]; // update global position hash by side to move num
 }
 
-static inline void unmakeNullMove() // a function to undo making of null moves, to follow makeNullMove being called in negaMax
+static inline void unmakeNullMove(NullUndo *u) // undo makeNullMove(), to follow it being called in negaMax
 {
-    side ^= 1;                                              // flip side to move
-    global_posHash ^= zobristNums[ZOBRIST_BLK_TO_PLAY_IDX]; // update global position hash by side to move num
+    side ^= 1;
+    en_passant = u->en_passant;
+    half_moves = u->half_moves;
+    global_posHash = u->hash;
 }
 
-/*
-Note : I notice the above 2 functions aren't different at all because en-passant state is not updated, will implement later.
-       For now I want to attempt major improvements to the search function so Superjelly can play comfortably at higher depths
-       without losing so much time.
-
-       Keeping this comment here as a critical note.
-*/
-
 /*
 Under certain conditions it is considered unwise to implement null move pruning. Those that I know of are:
     - Side to move is in check(opponent will take king)
     - It is the endgame (you could be in zugzwang)
-    - Depth is too low to reduce for null move pruning (I will do it by 2)
+    - Depth is too low to reduce for null move pruning
+    - We are inside a verification search, which exists to check a null move cutoff without null moves
 So I will make a boolean function dictating whether or not to engage in the NMP search
 based off the conditions listed above.
 */
-bool canMakeNullMove(int depth, bool in_check, bool endgame) // pass the current depth, and check/endgame booleans
+int nmp_min_ply = 0; // null moves are off below this ply while a verification search runs, 0 when none is running
+
+bool canMakeNullMove(int depth, int ply, bool in_check, bool endgame) // pass the current depth and ply, and check/endgame booleans
 {
-    if (depth < 3)
+    if (depth < NMP_MIN_DEPTH)
+    {
+        return false;
+    }
+    if (ply == 0 || ply < nmp_min_ply)
     {
         return false;
     }
@@ -2101,6 +2694,90 @@ int isIllegalMove(move_t move) // try a move and test for legality
     return 0;
 }
 
+/*
+Checks whether a pseudo legal move from genMoves() would leave our own king attacked, without making it.
+The occupancy after the move is rebuilt from the from/to/captured squares and the king square is tested against the
+enemy pieces that survive the move. Castling never needs a check here since genMoves() already verified the king doesn't
+start, pass or land on an attacked square.
+
+This is a lot cheaper than makeMove()/unmakeMove(), which copy the whole board, so perft uses it to count the
+leaves at depth 1 without making them.
+*/
+static inline bool leavesKingInCheck(move_t move)
+{
+    int from = getSourceSq(move);
+    int to = getTargetSq(move);
+    int flags = getFlags(move);
+    int piece = piece_on_square[from];
+    int enemy = (side == white) ? p : P; // offset of the enemy pieces in the piece enumeration
+
+    if (flags == 0b0010 || flags == 0b0011)
+    {
+        return false;
+    }
+
+    // bitboard of the captured piece, if any. en-passant captures a pawn which isn't on the target square.
+    U64 captured = 0ULL;
+    if (flags == 0b0101)
+    {
+        captured = 1ULL << ((side == white) ? to + 8 : to - 8);
+    }
+    else if (flags & 0b0100)
+    {
+        captured = 1ULL << to;
+    }
+
+    U64 occupancy = (occupancy_bitboards[both] & ~(1ULL << from) & ~captured) | (1ULL << to);
+    int king_square = (piece == K || piece == k) ? to : get_lsb_index(piece_bitboards[(side == white) ? K : k]);
+
+    if (pawn_attacks[side][king_square] & piece_bitboards[enemy + P] & ~captured)
+        return true;
+    if (knight_attacks[king_square] & piece_bitboards[enemy + N] & ~captured)
+        return true;
+    if (king_attacks[king_square] & piece_bitboards[enemy + K])
+        return true;
+    if (genBishopAttacks(occupancy, king_square) & (piece_bitboards[enemy + B] | piece_bitboards[enemy + Q]) & ~captured)
+        return true;
+    if (genRookAttacks(occupancy, king_square) & (piece_bitboards[enemy + R] | piece_bitboards[enemy + Q]) & ~captured)
+        return true;
+    return false;
+}
+
+static inline int isInCheck() // is the side to move in check, a missing king counts as a check
+{
+    U64 king = piece_bitboards[(side == white) ? K : k];
+    if (!king)
+    {
+        return 1;
+    }
+    return isSquareAttacked(get_lsb_index(king), side ^ 1);
+}
+
+/*
+A position can only repeat if no irreversible move (pawn move, capture) was made since it occured, and half_moves
+counts exactly those reversible plies. So we only need to scan back half_moves entries of the repetition stack, and
+only every second entry since the side to move has to be the same.
+
+Null moves don't push onto the repetition stack and reset half_moves, so the scan never reaches past a null move,
+which is what we want : a position reached through a null move isn't really a repetition.
+*/
+static inline bool isRepetition()
+{
+    int stop = repetition_idx - half_moves;
+    if (stop < 0)
+    {
+        stop = 0;
+    }
+    for (int index = repetition_idx - 2; index >= stop; index -= 2)
+    {
+        if (repetition[index] == global_posHash)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 /******************\
 --------------------
     Evaluation
@@ -2459,32 +3136,217 @@ static inline int evaluate()
         Perft
 --------------------
 \******************/
-int getTime()
+int getTime() // milliseconds from an arbitrary starting point, only ever used for differences
 {
+#ifdef _WIN32
     return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
 }
 
-long long perft(int depth)
+/*
+The perft hash table maps (position hash, depth) to a node count, so transposed subtrees are only counted once.
+Every entry stores the count and depth packed together in data, and key ^ data instead of the key itself. Threads write
+entries without any locking, so an entry can end up half written by two threads at once. With this trick a torn entry
+simply fails the key check on the next probe instead of returning a wrong count.
+*/
+typedef struct
 {
-    if (depth == 0)
-    {
+    U64 key;  // position hash XOR data
+    U64 data; // node count << 8 | depth
+} perft_entry;
+
+perft_entry *perft_table = NULL; // allocated by initPerftHash(), NULL when perft hashing is disabled
+U64 perft_table_size = 0;        // count of entries, a power of two
+int perft_table_megabytes = 0;
+
+void initPerftHash(int megabytes) // (re)allocate the perft hash table, 0 megabytes disables it
+{
+    if (megabytes == perft_table_megabytes)
+    {
+        return; // entries stay valid between runs and positions, so keep them
+    }
+    free(perft_table);
+    perft_table = NULL;
+    perft_table_size = 0;
+    perft_table_megabytes = megabytes;
+    if (megabytes <= 0)
+    {
+        return;
+    }
+    U64 entries = 1;
+    while (entries * 2 * sizeof(perft_entry) <= (U64)megabytes * 1024 * 1024)
+    {
+        entries *= 2;
+    }
+    perft_table = calloc(entries, sizeof(perft_entry));
+    if (perft_table == NULL)
+    {
+        fprintf(stderr, "failed to allocate %d MB for the perft hash table\n", megabytes);
+        perft_table_megabytes = 0;
+        return;
+    }
+    perft_table_size = entries;
+}
+
+long long perft(int depth)
+{
+    if (depth == 0)
+    {
         return 1;
     }
     long long nodes = 0;
     moves move_list;
     genMoves(&move_list);
+    // bulk counting : at depth 1 every legal move is exactly one leaf, so count them instead of making them
+    if (depth == 1)
+    {
+        for (int i = 0; i < move_list.total_count; i++)
+        {
+            if (!leavesKingInCheck(getMove(move_list.entries[i])))
+            {
+                nodes++;
+            }
+        }
+        return nodes;
+    }
+    perft_entry *entry = NULL;
+    if (perft_table)
+    {
+        entry = &perft_table[global_posHash & (perft_table_size - 1)];
+        U64 data = entry->data;
+        if ((data & 0xFF) == (U64)depth && (entry->key ^ data) == global_posHash)
+        {
+            return (long long)(data >> 8);
+        }
+    }
     for (int i = 0; i < move_list.total_count; i++)
     {
-        if (!makeMove(move_list.moves[i]))
+        if (!makeMove(getMove(move_list.entries[i])))
         {
             continue;
         }
         nodes += perft(depth - 1);
         unmakeMove();
     }
+    if (entry)
+    {
+        U64 data = ((U64)nodes << 8) | depth;
+        entry->key = global_posHash ^ data;
+        entry->data = data;
+    }
     return nodes;
 }
 
+/*
+Parallel perft splits the root moves between threads. Every thread copies the root position into its own board
+(see the _Thread_local position globals), then keeps taking the next unclaimed root move until none are left.
+Counts are kept per root move so divide can print them afterwards in move generation order.
+*/
+typedef struct
+{
+    Undo root;                // root position every thread starts from
+    moves root_moves;         // pseudo legal root moves
+    long long counts[MAX_MOVES]; // node count below every root move, -1 for illegal moves
+    int depth;                // perft depth of the root
+    int next_move;            // index of the next root move nobody claimed yet, taken with an atomic add
+} perft_job;
+
+void *perftWorker(void *arg)
+{
+    perft_job *job = arg;
+    // helper threads start with an empty board and empty stacks, for the calling thread this changes nothing
+    restorePosition(&job->root);
+    int index;
+    while ((index = __atomic_fetch_add(&job->next_move, 1, __ATOMIC_RELAXED)) < job->root_moves.total_count)
+    {
+        if (!makeMove(getMove(job->root_moves.entries[index])))
+        {
+            job->counts[index] = -1;
+            continue;
+        }
+        job->counts[index] = perft(job->depth - 1);
+        unmakeMove();
+    }
+    return NULL;
+}
+
+long long perftRoot(int depth, int threads, bool divide) // perft of the current position using threads, printing every root move if divide
+{
+    if (depth < 1)
+    {
+        return 1;
+    }
+    perft_job *job = malloc(sizeof(perft_job));
+    savePosition(&job->root);
+    genMoves(&job->root_moves);
+    job->depth = depth;
+    job->next_move = 0;
+
+    // the calling thread works too, so only threads - 1 helpers are started
+    pthread_t helpers[MAX_THREADS];
+    int started = 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    for (int i = 1; i < threads && i < MAX_THREADS; i++)
+    {
+        if (pthread_create(&helpers[started], &attr, perftWorker, job) == 0)
+        {
+            started++;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    perftWorker(job);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(helpers[i], NULL);
+    }
+
+    char move_string[6];
+    long long total = 0;
+    for (int i = 0; i < job->root_moves.total_count; i++)
+    {
+        if (job->counts[i] < 0)
+        {
+            continue;
+        }
+        total += job->counts[i];
+        if (divide)
+        {
+            moveToString(getMove(job->root_moves.entries[i]), move_string);
+            printf("%s: %lld\n", move_string, job->counts[i]);
+        }
+    }
+    if (divide)
+    {
+        printf("\n");
+    }
+    free(job);
+    return total;
+}
+
+void printPerftSpeed(long long nodes, int elapsed) // print node count, time, and millions of nodes per second
+{
+    printf("Nodes: %lld Time: %d ms Mnps: %.2f\n", nodes, elapsed, nodes / 1000.0 / (elapsed > 0 ? elapsed : 1));
+    fflush(stdout);
+}
+
+void parsePerft(char *input, bool divide) // parse "perft <depth> [threads] [hash]" or "divide <depth> [threads] [hash]"
+{
+    int depth = 1;
+    int threads = 1;
+    int hash_mb = 0;
+    sscanf(input, "%d %d %d", &depth, &threads, &hash_mb);
+    initPerftHash(hash_mb);
+    int start = getTime();
+    long long count = perftRoot(depth, threads, divide);
+    printPerftSpeed(count, getTime() - start);
+}
+
 /******************\
 --------------------
        Search
@@ -2517,38 +3379,275 @@ static inline int getMVVLVAScore(move_t move)
     int to = getTargetSq(move);
     int attacker = piece_on_square[from];
     int victim = piece_on_square[to];
-    if (victim == no_piece || attacker == no_piece)
+    if (attacker == no_piece)
     {
         return 0;
     }
+    if (victim == no_piece)
+    {
+        // en-passant (target square is empty) and quiet promotions still score as a pawn capture, so every capture and
+        // promotion sorts above the quiet moves and quiescence can stop at the first quiet move it picks
+        return (getFlags(move) == 0b0101 || (getFlags(move) & 0b1000)) ? mvv_lva[attacker][P] : 0;
+    }
     return mvv_lva[attacker][victim];
 }
-static inline int sortMoves(moves *move_list)
+static inline U64 attackersTo(int square, U64 occupancy) // pieces of both sides attacking square, sliders seen through occupancy
 {
-    int move_count = move_list->total_count;
-    int move_scores[move_count];
-    for (int i = 0; i < move_count; i++)
+    return (pawn_attacks[black][square] & piece_bitboards[P]) | (pawn_attacks[white][square] & piece_bitboards[p]) |
+           (knight_attacks[square] & (piece_bitboards[N] | piece_bitboards[n])) |
+           (king_attacks[square] & (piece_bitboards[K] | piece_bitboards[k])) |
+           (genBishopAttacks(occupancy, square) & (piece_bitboards[B] | piece_bitboards[b] | piece_bitboards[Q] | piece_bitboards[q])) |
+           (genRookAttacks(occupancy, square) & (piece_bitboards[R] | piece_bitboards[r] | piece_bitboards[Q] | piece_bitboards[q]));
+}
+
+/*
+Static exchange evaluation : the material outcome of the capture sequence on the target square of a move, both sides
+always recapturing with their least valuable attacker and free to stop when going on would lose. gain[d] is the score
+of the side making capture d if the sequence stopped after it, then the list is folded back from the end with each side
+picking the better of stopping or going on. Sliders behind a piece that captured are uncovered through the occupancy.
+*/
+static inline int see(move_t move)
+{
+    int from = getSourceSq(move);
+    int to = getTargetSq(move);
+    int gain[32];
+    int d = 0;
+    int attacker = piece_on_square[from];
+    U64 occupancy = occupancy_bitboards[both];
+    if (piece_on_square[to] != no_piece)
     {
-        move_scores[i] = getMVVLVAScore(move_list->moves[i]); // populate move_scores[]
+        gain[0] = pieceValue[piece_on_square[to]];
     }
-    for (int currMoveIndex = 0; currMoveIndex < move_count; currMoveIndex++)
-    { // simple bubble sort
-        for (int nextMoveIndex = currMoveIndex + 1; nextMoveIndex < move_count; nextMoveIndex++)
+    else if (getFlags(move) == 0b0101) // en-passant, the captured pawn isn't on the target square
+    {
+        gain[0] = pieceValue[P];
+        occupancy ^= 1ULL << (to + ((side == white) ? 8 : -8));
+    }
+    else
+    {
+        gain[0] = 0;
+    }
+    U64 diagonal_sliders = piece_bitboards[B] | piece_bitboards[b] | piece_bitboards[Q] | piece_bitboards[q];
+    U64 straight_sliders = piece_bitboards[R] | piece_bitboards[r] | piece_bitboards[Q] | piece_bitboards[q];
+    U64 attackers = attackersTo(to, occupancy);
+    U64 from_bitboard = 1ULL << from;
+    int stm = side;
+    while (from_bitboard && d < 31)
+    {
+        d++;
+        gain[d] = pieceValue[attacker] - gain[d - 1]; // score if the piece just put on the square gets taken
+        if ((-gain[d - 1] > gain[d] ? -gain[d - 1] : gain[d]) < 0)
+            break; // neither stopping nor going on helps the side to capture, the outcome is decided
+        occupancy ^= from_bitboard;
+        attackers |= (genBishopAttacks(occupancy, to) & diagonal_sliders) | (genRookAttacks(occupancy, to) & straight_sliders);
+        attackers &= occupancy;
+        stm ^= 1;
+        from_bitboard = 0;
+        for (int piece = (stm == white) ? P : p; piece <= ((stm == white) ? K : k); piece++)
         {
-            if (move_scores[currMoveIndex] < move_scores[nextMoveIndex])
+            U64 bitboard = attackers & piece_bitboards[piece];
+            if (bitboard)
             {
-                // swap scores around
-                int tempScore = move_scores[currMoveIndex];
-                move_scores[currMoveIndex] = move_scores[nextMoveIndex];
-                move_scores[nextMoveIndex] = tempScore;
-
-                // swap moves around
-                move_t tempMove = move_list->moves[currMoveIndex];
-                move_list->moves[currMoveIndex] = move_list->moves[nextMoveIndex];
-                move_list->moves[nextMoveIndex] = tempMove;
+                from_bitboard = bitboard & -bitboard;
+                attacker = piece;
+                break;
             }
         }
     }
+    while (--d > 0)
+    {
+        gain[d - 1] = -((-gain[d - 1] > gain[d]) ? -gain[d - 1] : gain[d]);
+    }
+    return gain[0];
+}
+
+static inline void scoreMoves(moves *move_list, move_t tt_move) // MVV-LVA for captures, the TT move (if any) goes first
+{
+    for (int i = 0; i < move_list->total_count; i++)
+    {
+        move_t move = getMove(move_list->entries[i]);
+        int score = (move == tt_move) ? TT_MOVE_SCORE : getMVVLVAScore(move);
+        move_list->entries[i] = makeEntry(move, score); // store the score next to its move
+    }
+}
+
+/*
+Quiet move ordering. Captures have MVV-LVA, quiet moves need something learned from the search itself :
+    - the countermove table remembers, for the previous move's piece and target square, the quiet move that refuted it.
+    - continuation history scores a quiet move by how often it caused a cutoff right after the move one ply ago
+      (follow up to the opponent's move) and two plies ago (our own previous move), indexed [piece][to][piece][to].
+History is updated with a gravity bonus : entry += bonus - entry * |bonus| / HISTORY_MAX, which moves the entry towards
++-HISTORY_MAX and never past it, so old information fades instead of saturating. The cutoff move gets a bonus and the quiet
+moves searched before it a malus.
+
+These tables and the stack of moves leading to the current node make up the search context, grouped in search_context so
+a search owns one instance (search_ctx) rather than loose globals. The tables survive between searches of the same game
+and are cleared by "ucinewgame".
+*/
+#define HISTORY_MAX 16384
+#define CAPTURE_SCORE 20000     // captures and promotions are ordered above every quiet move, by MVV-LVA among themselves
+#define COUNTER_MOVE_SCORE 15000 // the countermove goes right after them, quiet moves (at most +-HISTORY_MAX / 2) follow
+#define QUIET_HISTORY_DIVISOR 4  // quiet score = sum of both continuation histories / 4, so at most +-2 * HISTORY_MAX / 4
+
+typedef struct
+{
+    move_t move; // move made at this ply, 0 for a null move
+    int piece;   // piece that moved, no_piece for a null move
+} stack_entry;
+
+typedef struct
+{
+    stack_entry stack[MAX_PLY];                      // moves leading to the current node, indexed by ply
+    move_t counter_moves[12][64];                    // [previous piece][previous target] = quiet move that refuted it
+    int16_t continuation_history[2][12][64][12][64]; // [plies back - 1][previous piece][previous target][piece][target]
+} search_context;
+
+search_context search_ctx;
+
+long long cutoffs = 0;            // beta cutoffs in negaMax this search
+long long first_move_cutoffs = 0; // the ones caused by the first legal move searched
+
+void clearHistory()
+{
+    memset(search_ctx.counter_moves, 0, sizeof(search_ctx.counter_moves));
+    memset(search_ctx.continuation_history, 0, sizeof(search_ctx.continuation_history));
+}
+
+static inline void updateHistory(int16_t *entry, int bonus)
+{
+    int value = *entry;
+    value += bonus - value * (bonus < 0 ? -bonus : bonus) / HISTORY_MAX;
+    *entry = value;
+}
+
+static inline int quietHistory(int ply, int piece, int to) // sum of both continuation histories of a quiet move
+{
+    int score = 0;
+    for (int back = 1; back <= 2 && back <= ply; back++)
+    {
+        stack_entry *previous = &search_ctx.stack[ply - back];
+        if (previous->move)
+        {
+            score += search_ctx.continuation_history[back - 1][previous->piece][getTargetSq(previous->move)][piece][to];
+        }
+    }
+    return score;
+}
+
+static inline void updateQuietHistory(int ply, move_t move, int bonus)
+{
+    int piece = piece_on_square[getSourceSq(move)];
+    int to = getTargetSq(move);
+    for (int back = 1; back <= 2 && back <= ply; back++)
+    {
+        stack_entry *previous = &search_ctx.stack[ply - back];
+        if (previous->move)
+        {
+            updateHistory(&search_ctx.continuation_history[back - 1][previous->piece][getTargetSq(previous->move)][piece][to], bonus);
+        }
+    }
+}
+
+static inline void scoreMovesWithHistory(moves *move_list, move_t tt_move, int ply) // full ordering used by negaMax
+{
+    move_t counter_move = 0;
+    if (ply > 0 && search_ctx.stack[ply - 1].move)
+    {
+        counter_move = search_ctx.counter_moves[search_ctx.stack[ply - 1].piece][getTargetSq(search_ctx.stack[ply - 1].move)];
+    }
+    for (int i = 0; i < move_list->total_count; i++)
+    {
+        move_t move = getMove(move_list->entries[i]);
+        int score;
+        if (move == tt_move)
+            score = TT_MOVE_SCORE;
+        else if (getFlags(move) & 0b1100)
+            score = CAPTURE_SCORE + getMVVLVAScore(move);
+        else if (move == counter_move)
+            score = COUNTER_MOVE_SCORE;
+        else
+            score = quietHistory(ply, piece_on_square[getSourceSq(move)], getTargetSq(move)) / QUIET_HISTORY_DIVISOR;
+        move_list->entries[i] = makeEntry(move, score);
+    }
+}
+
+/*
+Instead of sorting the whole list up front, pickNextMove() does one step of a selection sort : it finds the best entry
+from index onwards, swaps it into index and returns its move. A node that cuts off after its first move (most qsearch
+nodes) only pays for one pass over the list instead of a full sort. Since the score sits in the high bits, comparing
+entries as int32 compares scores, with ties going to the higher move code.
+*/
+static inline move_t pickNextMove(moves *move_list, int index)
+{
+    int best = index;
+    for (int i = index + 1; i < move_list->total_count; i++)
+    {
+        if (move_list->entries[i] > move_list->entries[best])
+        {
+            best = i;
+        }
+    }
+    move_entry_t temp = move_list->entries[index];
+    move_list->entries[index] = move_list->entries[best];
+    move_list->entries[best] = temp;
+    return getMove(move_list->entries[index]);
+}
+
+/*
+When sort_trace is set (only by the "sortbench" command), quiescence copies every scored move list into it together with
+the number of moves it actually picked. That gives the sort bench real move lists and real cutoff points to replay.
+The hooks sit in the hottest loop of the engine, so they are only compiled with -DSORT_TRACE ("make sortbench").
+*/
+#ifdef SORT_TRACE
+#define SORT_TRACE_SIZE 20000
+typedef struct
+{
+    moves list; // move list as scored, before any move was picked
+    int picked; // number of moves picked before the node returned
+} traced_list;
+traced_list *sort_trace = NULL;
+int sort_trace_count = 0;
+#endif
+
+/*
+Search parameters that can be tuned from outside through UCI "setoption" (see tunables[] below). They are kept as plain
+globals so the search reads them as fast as a constant. Margins are in centipawns per ply of remaining depth.
+The defaults live in the table only, resetTunables() copies them into the globals at startup and "uci" reports them.
+*/
+int rfp_margin;      // reverse futility pruning : static eval - margin * depth >= beta and the node fails high
+int futility_margin; // futility pruning : static eval + margin * depth <= alpha and quiet moves can't raise alpha
+int razor_margin;    // razoring : static eval + margin * depth < alpha and the node drops into quiescence
+int delta_margin;    // delta pruning : stand pat + captured piece value + margin <= alpha and the capture can't help
+int probcut_margin;  // ProbCut : a SEE winning capture has to beat beta + margin in the reduced search
+int singular_margin; // singular extensions : the other moves are searched against TT score - margin * depth
+int qs_checks;       // 1 to also search quiet checking moves at the first quiescence ply
+
+typedef struct
+{
+    char *name; // UCI option name
+    int *value; // the global it sets
+    int default_value;
+    int min;
+    int max;
+} tunable;
+
+tunable tunables[] = {
+    {"RFPMargin", &rfp_margin, 100, 0, 1000},
+    {"FutilityMargin", &futility_margin, 150, 0, 1000},
+    {"RazorMargin", &razor_margin, 250, 0, 1000},
+    {"DeltaMargin", &delta_margin, 200, 0, 1000},
+    {"ProbCutMargin", &probcut_margin, 200, 0, 1000},
+    {"SingularMargin", &singular_margin, 3, 0, 100},
+    {"QSChecks", &qs_checks, 0, 0, 1},
+};
+#define TUNABLE_COUNT (int)(sizeof(tunables) / sizeof(tunables[0]))
+
+void resetTunables() // set every tunable search parameter to its default
+{
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+    {
+        *tunables[i].value = tunables[i].default_value;
+    }
 }
 
 /*
@@ -2573,13 +3672,29 @@ static inline int sortMoves(moves *move_list)
     for us as black. So we cutoff the branch and search no further.
 */
 move_t best_move = 0; // global best move variable to store best move found by search
-int nodes = 0;        // global nodes variable for counting nodes search
+int completed_depth = 0; // deepest iteration the last searchPos() finished
+
+/*
+Triangular PV table : pv_table[ply] holds the best line found from ply on, pv_length[ply] the ply it ends at. When a move
+raises alpha at some ply, its line becomes that move followed by the line of the child. pv_table[0] is the whole PV.
+*/
+move_t pv_table[MAX_PLY + 1][MAX_PLY + 1];
+int pv_length[MAX_PLY + 1];
+
+int multi_pv = 1;                    // number of lines to search, set with the UCI "MultiPV" option
+move_t root_excluded[MAX_MULTI_PV];  // root moves of the lines already found this iteration
+int root_excluded_count = 0;
+long long nodes = 0;  // global nodes variable for counting nodes search
+long long qnodes = 0; // the part of nodes spent in quiescence search
 int start_time;
-int time_limit;
+int time_limit;             // hard limit, the search stops in the middle of an iteration once it is used up
+int soft_time_limit;        // no new iteration is started past it, scaled by how stable the best move is
+bool search_stopped = false; // set once the hard limit is hit, every node then unwinds right away
 
 void startTimer(int max_time)
 {
     time_limit = max_time;  // update global variable
+    soft_time_limit = max_time;
     start_time = getTime(); // update global variable
 }
 bool timedOut()
@@ -2587,148 +3702,515 @@ bool timedOut()
     return (getTime() - start_time) > time_limit * 0.95;
 }
 
-static inline int quiescence(int alpha, int beta, int ply) // quiescence search which will be called in negaMax()
+/*
+The search runs on the thread reading the GUI, so while it searches it has to look at stdin itself for "stop" (end the
+search and play the best move so far, the only way a "go infinite" ends) and "quit". Only searches started by "go" do,
+the suites and bench are driven by commands that are already read. uciLoop() makes stdin unbuffered, otherwise a line
+could sit in the stdio buffer where select() can't see it.
+
+Any other line read during a search ("position", "setoption", "ucinewgame", "ponderhit", ...) is queued in
+pending_commands and handed to parseCommand() by uciLoop() once the search is over, in the order it came.
+*/
+#define MAX_PENDING_COMMANDS 16 // lines the GUI can send during one search before they get dropped
+
+bool uci_search = false;      // the current search was started by "go" and listens for "stop"
+bool infinite_search = false; // "go infinite" : bestmove only goes out after "stop", even if every depth was searched
+bool quit_requested = false;  // "quit" arrived during a search, uciLoop() ends once the search is done
+char pending_commands[MAX_PENDING_COMMANDS][2000];
+int pending_first = 0; // oldest queued line
+int pending_count = 0;
+
+static bool inputWaiting()
 {
-    nodes++;             // increment nodes on function call
-    if (nodes % 64 == 0) // check time every 64 nodes
+#ifdef _WIN32
+    DWORD available = 0;
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    if (!PeekNamedPipe(input, NULL, 0, NULL, &available, NULL)) // not a pipe, a console : ask how many events are queued
     {
-        if (timedOut())
-        {
-            return TIMEOUT;
-        }
+        GetNumberOfConsoleInputEvents(input, &available);
+        return available > 1;
     }
-    TT_entry *entry = probeTT(global_posHash);
-    if (entry)
+    return available > 0;
+#else
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(fileno(stdin), &read_fds);
+    struct timeval no_wait = {0, 0};
+    return select(fileno(stdin) + 1, &read_fds, NULL, NULL, &no_wait) > 0;
+#endif
+}
+
+static void readSearchInput() // handle one line the GUI sent during a search, there has to be one waiting
+{
+    char input[2000];
+    if (fgets(input, sizeof(input), stdin) == NULL)
     {
-        return entry->eval;
+        uci_search = false; // stdin was closed, nothing will ever come, stop looking
+        return;
     }
-    // stand-pat static evaluation of current position
-    int stand = evaluate();
-    if (stand >= beta)
-        return stand;
-    if (alpha < stand)
-        alpha = stand;
-
-    moves move_list[1];
-    genMoves(&move_list[0]);
-    sortMoves(&move_list[0]);
-
-    for (int i = 0; i < move_list[0].total_count; ++i)
+    if (strncmp(input, "stop", 4) == 0)
     {
-        int flags = getFlags(move_list[0].moves[i]);
-        // extend search only on captures or promotions (including en_passant)
-        if (!(flags & 0b0100) && !(flags & 0b1000))
-            continue;
-
-        if (!makeMove(move_list[0].moves[i]))
-            continue; // illegal -> skip (makeMove restores state on failure)
-        int score = -quiescence(-beta, -alpha, ply + 1);
-        unmakeMove();
-
-        if (score >= beta)
-            return score;
-        if (score > alpha)
-            alpha = score;
+        search_stopped = true;
+    }
+    else if (strncmp(input, "quit", 4) == 0)
+    {
+        search_stopped = true;
+        quit_requested = true;
+    }
+    else if (strncmp(input, "isready", 7) == 0) // the GUI may check we are alive during a long search
+    {
+        printf("readyok\n");
+        fflush(stdout);
+    }
+    else if (pending_count < MAX_PENDING_COMMANDS)
+    {
+        strcpy(pending_commands[(pending_first + pending_count) % MAX_PENDING_COMMANDS], input);
+        pending_count++;
+    }
+    else
+    {
+        printf("info string too many commands during the search, dropped %s", input);
+        fflush(stdout);
     }
-    storeTTentry(global_posHash, 0, 0, alpha, 0); // (logic for values) store hash, no best move , depth is 0, eval is alpha, node type is exact
-
-    return alpha;
 }
 
-static inline int negaMax(int alpha, int beta, int depth, int ply)
+bool nextPendingCommand(char *line) // take the oldest line queued during a search, false if there is none
 {
-
-    nodes++;             // increment nodes on any function call
-    if (nodes % 64 == 0) // check time every 2048 nodes
+    if (pending_count == 0)
     {
-        if (timedOut())
-        {
-            return TIMEOUT;
-        }
+        return false;
     }
+    strcpy(line, pending_commands[pending_first]);
+    pending_first = (pending_first + 1) % MAX_PENDING_COMMANDS;
+    pending_count--;
+    return true;
+}
 
-    TT_entry *entry = probeTT(global_posHash);
-
-    if (entry && entry->depth >= depth)
+void checkStop() // called every 64 nodes, stops the search on the hard time limit or a "stop"/"quit" from the GUI
+{
+    if (timedOut())
     {
-        switch (entry->node_type)
-        {
-        case PV_NODE:
-            return entry->eval; // exact score, return right away
-        case CUT_NODE:
-            if (entry->eval >= beta)
-                return entry->eval;
-            break; // only return if we know score is "too good" for opponent to allow
-        case ALL_NODE:
-            if (entry->eval <= alpha)
-                return entry->eval;
-            break; // only return if we know score cant improve alpha, our guranteed minimum
-        };
+        search_stopped = true;
+        return;
     }
-    // recursion ending condition
-    if (depth == 0)
+    if (uci_search && nodes % 4096 == 0 && inputWaiting())
     {
+        readSearchInput();
+    }
+}
 
-        // quick legal-move existence test
-        moves legal_Check[1];
-
-        genMoves(&legal_Check[0]);
-        int found_legal = 0;
-        for (int i = 0; i < legal_Check[0].total_count; ++i)
+void waitForStop() // "go infinite" that ran out of depth (a forced mate, a tiny tree) : keep reading input until "stop"
+{
+    while (uci_search && !search_stopped)
+    {
+        if (inputWaiting())
         {
-            if (makeMove(legal_Check[0].moves[i]))
-            {
-                unmakeMove();
-                found_legal = 1;
-                break;
-            }
+            readSearchInput();
         }
-        if (!found_legal)
+        else
         {
-            // side to move has no legal replies -> mate or stalemate
-            int kingSq = (side == white) ? get_lsb_index(piece_bitboards[K]) : get_lsb_index(piece_bitboards[k]);
-            int in_check = (kingSq >= 0) ? isSquareAttacked(kingSq, !side) : 1;
-            if (in_check)
-                return -MATE + ply;
-            return 0;
+#ifdef _WIN32
+            Sleep(1);
+#else
+            usleep(1000);
+#endif
         }
-        // run quiescence search
-        return quiescence(alpha, beta, ply);
     }
+}
 
-    // increment nodes count
-
-    // is king in check
-    int kingInCheck = 0;
-    if (side == white)
-    {
-        if (countBits(piece_bitboards[K]))
-            kingInCheck = isSquareAttacked(get_lsb_index(piece_bitboards[K]), black);
-        else
-            kingInCheck = 1; // no king, treat as a check
+/*
+Quiescence search only looks at captures and promotions so the static eval is taken in a quiet position. Two exceptions :
+    - In check, standing pat makes no sense (the eval doesn't know the king is attacked) and the only legal moves are often
+      quiet ones, so every move is searched, and no legal move means mate.
+    - At the first qsearch ply (qs_ply 0), quiet moves giving check are searched too when QSChecks is on, which finds mates
+      and forcing lines just past the horizon. Deeper plies don't, so check, evade, check, evade can't go on forever.
+*/
+static inline int quiescence(int alpha, int beta, int ply, int qs_ply) // quiescence search which will be called in negaMax()
+{
+    nodes++;             // increment nodes on function call
+    qnodes++;
+    if (nodes % 64 == 0) // check time every 64 nodes
+    {
+        checkStop();
     }
-    else
+    if (search_stopped)
     {
-        if (countBits(piece_bitboards[k]))
-            kingInCheck = isSquareAttacked(get_lsb_index(piece_bitboards[k]), white);
-        else
-            kingInCheck = 1;
+        return TIMEOUT;
+    }
+    if (ply >= MAX_PLY)
+    {
+        return evaluate();
+    }
+    // any depth will do here, qsearch entries have depth 0, but the bound has to fit the window
+    TT_data hit;
+    if (probeTT(global_posHash, &hit) && ttScoreUsable(hit.node_type, scoreFromTT(hit.eval, ply), alpha, beta))
+    {
+        tt_cutoffs++;
+        return scoreFromTT(hit.eval, ply);
+    }
+    int original_alpha = alpha;
+    int in_check = isInCheck();
+    int stand = 0;
+    if (!in_check)
+    {
+        // stand-pat static evaluation of current position
+        stand = evaluate();
+        if (stand >= beta)
+            return stand;
+        if (alpha < stand)
+            alpha = stand;
+
+        /*
+        delta pruning for the whole node : even winning the opponent's best piece (plus a queen for a promotion if one of
+        our pawns is about to promote) doesn't get the stand pat up to alpha, so no capture here can.
+        */
+        int enemy = (side == white) ? p : P;
+        int best_gain = 0;
+        for (int piece = enemy + Q; piece >= enemy + P; piece--)
+        {
+            if (piece_bitboards[piece])
+            {
+                best_gain = pieceValue[piece];
+                break;
+            }
+        }
+        if (piece_bitboards[(side == white) ? P : p] & ((side == white) ? seventh_rank : second_rank))
+        {
+            best_gain += pieceValue[Q] - pieceValue[P];
+        }
+        if (stand + best_gain + delta_margin <= alpha)
+        {
+            return alpha;
+        }
+    }
+
+    moves move_list[1];
+    genMoves(&move_list[0]);
+    scoreMoves(&move_list[0], 0);
+#ifdef SORT_TRACE
+    traced_list *trace = NULL;
+    if (sort_trace && sort_trace_count < SORT_TRACE_SIZE)
+    {
+        trace = &sort_trace[sort_trace_count++];
+        trace->list = move_list[0];
+        trace->picked = 0;
+    }
+#endif
+
+    int legal_moves = 0;
+    for (int i = 0; i < move_list[0].total_count; ++i)
+    {
+        move_t move = pickNextMove(&move_list[0], i); // best remaining move by MVV-LVA
+#ifdef SORT_TRACE
+        if (trace)
+            trace->picked = i + 1;
+#endif
+        int flags = getFlags(move);
+        // out of check, extend search only on captures or promotions (including en_passant), and checks at the first ply
+        bool quiet = !(flags & 0b0100) && !(flags & 0b1000);
+        if (quiet && !in_check && !(qs_checks && qs_ply == 0))
+            break; // quiet moves sort after every capture and promotion, the rest of the list is quiet too
+
+        // delta pruning per move : a capture that doesn't promote has to win enough material to reach alpha
+        if (!in_check && (flags & 0b1100) == 0b0100)
+        {
+            int victim = piece_on_square[getTargetSq(move)];
+            int gain = (victim == no_piece) ? pieceValue[P] : pieceValue[victim]; // en-passant target square is empty
+            if (stand + gain + delta_margin <= alpha)
+                continue;
+        }
+
+        if (!makeMove(move))
+            continue; // illegal -> skip (makeMove restores state on failure)
+        if (quiet && !in_check && !isInCheck()) // a quiet move at the first ply, but it doesn't give check
+        {
+            unmakeMove();
+            continue;
+        }
+        legal_moves++;
+        int score = -quiescence(-beta, -alpha, ply + 1, qs_ply + 1);
+        unmakeMove();
+        if (search_stopped)
+            return TIMEOUT;
+
+        if (score >= beta)
+        {
+            storeTTentry(global_posHash, move, 0, score, CUT_NODE, ply); // fail high, score is a lower bound
+            return score;
+        }
+        if (score > alpha)
+            alpha = score;
+    }
+    if (in_check && legal_moves == 0) // every move was searched and none was legal
+    {
+        return -MATE + ply;
+    }
+    // exact if a move raised alpha, otherwise alpha is only an upper bound. depth is 0 so any real search overwrites it
+    storeTTentry(global_posHash, 0, 0, alpha, (alpha > original_alpha) ? PV_NODE : ALL_NODE, ply);
+
+    return alpha;
+}
+
+static inline bool isRootExcluded(move_t move) // was this root move already the first move of a higher MultiPV line
+{
+    for (int i = 0; i < root_excluded_count; i++)
+    {
+        if (root_excluded[i] == move)
+            return true;
+    }
+    return false;
+}
+
+static inline int negaMax(int alpha, int beta, int depth, int ply, move_t excluded)
+{
+    pv_length[ply] = ply; // empty line until a move raises alpha, also for the MAX_PLY cut below so the parent copies nothing stale
+    if (ply >= MAX_PLY)
+    {
+        return evaluate();
+    }
+
+    nodes++;             // increment nodes on any function call
+    if (nodes % 64 == 0) // check time every 64 nodes
+    {
+        checkStop();
+    }
+    if (search_stopped)
+    {
+        return TIMEOUT;
+    }
+
+    /*
+    draw by repetition or by the 50 move rule. A single repetition inside the search is scored as a draw,
+    since if repeating is good for one side it can just repeat again. This is done before probing the TT so
+    the path dependant draw score never gets mixed up with the stored scores, and not at the root since we need a move.
+    */
+    if (ply > 0 && (half_moves >= 100 || isRepetition()))
+    {
+        return 0;
+    }
+    /*
+    mate distance pruning : being mated here scores -MATE + ply at best, and mating here MATE - ply - 1 at best.
+    If a shorter mate was already found higher up, alpha and beta cross once they are clamped to those bounds,
+    and nothing below this node can change the result.
+    */
+    if (ply > 0)
+    {
+        if (alpha < -MATE + ply)
+            alpha = -MATE + ply;
+        if (beta > MATE - ply - 1)
+            beta = MATE - ply - 1;
+        if (alpha >= beta)
+            return alpha;
+    }
+
+    // is king in check
+    int kingInCheck = isInCheck();
+    // check extension : search one ply deeper when in check, so forced lines don't end at the horizon in the middle of a check
+    if (kingInCheck)
+    {
+        depth++;
+    }
+
+    TT_data hit; // a copy, the entry can be overwritten further down the tree
+    bool tt_hit = probeTT(global_posHash, &hit);
+    move_t tt_move = tt_hit ? hit.topMove : 0;
+    int tt_eval = tt_hit ? scoreFromTT(hit.eval, ply) : 0;
+    int tt_depth = tt_hit ? hit.depth : -1;
+    int tt_node_type = tt_hit ? hit.node_type : PV_NODE;
+
+    // the entry belongs to the search of every move, not the one without the excluded move, so it can't cut it off
+    // at the root the search has to come back with a move and a PV, so no TT cutoffs there
+    if (tt_hit && !excluded && ply > 0 && tt_depth >= depth && ttScoreUsable(tt_node_type, tt_eval, alpha, beta))
+    {
+        tt_cutoffs++;
+        return tt_eval;
+    }
+    if (tt_move)
+    {
+        tt_move_hits++;
+    }
+    // recursion ending condition
+    if (depth == 0)
+    {
+
+        // quick legal-move existence test
+        moves legal_Check[1];
+
+        genMoves(&legal_Check[0]);
+        int found_legal = 0;
+        for (int i = 0; i < legal_Check[0].total_count; ++i)
+        {
+            if (makeMove(getMove(legal_Check[0].entries[i])))
+            {
+                unmakeMove();
+                found_legal = 1;
+                break;
+            }
+        }
+        if (!found_legal)
+        {
+            // side to move has no legal replies -> mate or stalemate
+            if (kingInCheck)
+                return -MATE + ply;
+            return 0;
+        }
+        // run quiescence search
+        return quiescence(alpha, beta, ply, 0);
+    }
+
+    /*
+    internal iterative reduction : without a TT move the first move searched is a guess, and a bad first move makes the
+    whole node expensive. Search it one ply shallower instead, the next iteration will find a TT move stored by this one.
+    Only open window nodes are reduced : the null window nodes here are the replies to a null move, expected to fail
+    low whatever is searched first, so ordering can't be what makes them expensive.
+    */
+    if (depth >= IIR_MIN_DEPTH && tt_move == 0 && !excluded && beta - alpha > 1)
+    {
+        depth--;
+    }
+
+    /*
+    Shallow depth pruning, out of check, below the root and not when alpha or beta is a mate score. The search has no
+    null window re-searches, so nearly every node has an open window and these can't be limited to null window nodes.
+        - reverse futility pruning : the static eval is so far above beta that no reply will bring it back down.
+        - razoring : the static eval is so far below alpha that only captures could help, let quiescence decide.
+        - futility pruning (in the move loop) : quiet moves that don't give check can't lift the eval up to alpha.
+    */
+    int static_eval = kingInCheck ? -MATE : evaluate();
+    bool shallow = !kingInCheck && !excluded && ply > 0 && depth <= SHALLOW_PRUNING_DEPTH &&
+                   alpha > -MATE_BOUND && beta < MATE_BOUND;
+    if (shallow && static_eval - rfp_margin * depth >= beta)
+    {
+        return beta;
+    }
+    if (shallow && static_eval + razor_margin * depth < alpha)
+    {
+        int razor_score = quiescence(alpha, beta, ply, 0);
+        if (search_stopped)
+            return TIMEOUT;
+        if (razor_score <= alpha)
+        {
+            return alpha;
+        }
     }
+    bool futile = shallow && static_eval + futility_margin * depth <= alpha;
+
     // start of null-move pruning search
+    /*
+    Give the opponent a free move. If a reduced search still fails high, our real moves will too. The reduction grows with
+    depth and with how far the static eval is above beta, so clearly won positions get pruned with a shallower search.
+    At high depth a null move cutoff is verified by a reduced search of our own moves with null moves turned off for a few
+    plies, which catches zugzwang positions where passing would be the best move.
+    */
+    if (!excluded && canMakeNullMove(depth, ply, kingInCheck, isEndgame()))
+    {
+        if (static_eval >= beta)
+        {
+            int reduction = NMP_BASE_REDUCTION + depth / NMP_DEPTH_DIVISOR;
+            int eval_bonus = (static_eval - beta) / NMP_EVAL_DIVISOR;
+            reduction += (eval_bonus < NMP_MAX_EVAL_REDUCTION) ? eval_bonus : NMP_MAX_EVAL_REDUCTION;
+            int null_depth = depth - 1 - reduction;
+            if (null_depth < 0)
+                null_depth = 0;
+
+            NullUndo null_undo;
+            search_ctx.stack[ply].move = 0; // nothing to continue from after a null move
+            search_ctx.stack[ply].piece = no_piece;
+            makeNullMove(&null_undo);
+            int null_search_score = -negaMax(-beta, -beta + 1, null_depth, ply + 1, 0);
+            unmakeNullMove(&null_undo);
+            if (search_stopped)
+                return TIMEOUT;
+            if (null_search_score >= beta)
+            {
+                if (depth < NMP_VERIFICATION_DEPTH || nmp_min_ply != 0)
+                {
+                    return beta;
+                }
+                nmp_min_ply = ply + 3 * null_depth / 4; // no null moves in the first 3/4 of the verification search
+                int verified_score = negaMax(beta - 1, beta, null_depth, ply, 0);
+                nmp_min_ply = 0;
+                if (search_stopped)
+                    return TIMEOUT;
+                if (verified_score >= beta)
+                {
+                    return beta;
+                }
+            }
+        }
+    }
+
+    // end of null move pruning search
+
+    /*
+    ProbCut : a capture that wins material by SEE and still beats beta by a margin in a much shallower search will almost
+    surely beat beta in the full depth one too. Captures are first tried in quiescence, and only the ones that hold there
+    are verified with a search 4 plies shallower. Skipped when a deep enough TT entry already says the node stays below the
+    raised beta (a CUT_NODE score is only a lower bound, so it says nothing about that).
+    */
+    int probcut_beta = beta + probcut_margin;
+    if (ply > 0 && !excluded && !kingInCheck && depth >= PROBCUT_MIN_DEPTH && beta > -MATE_BOUND && beta < MATE_BOUND &&
+        !(tt_hit && tt_depth >= depth - 3 && tt_eval < probcut_beta && tt_node_type != CUT_NODE))
+    {
+        moves capture_list[1];
+        genMoves(&capture_list[0]);
+        scoreMoves(&capture_list[0], tt_move);
+        for (int i = 0; i < capture_list[0].total_count; i++)
+        {
+            move_t move = pickNextMove(&capture_list[0], i);
+            if ((getFlags(move) & 0b1100) != 0b0100) // captures only, promotions are left to the main search
+                continue;
+            int exchange = see(move);
+            if (exchange < 0 || exchange < probcut_beta - static_eval)
+                continue;
+            int moving_piece = piece_on_square[getSourceSq(move)];
+            if (!makeMove(move))
+                continue;
+            search_ctx.stack[ply].move = move;
+            search_ctx.stack[ply].piece = moving_piece;
+            int score = -quiescence(-probcut_beta, -probcut_beta + 1, ply + 1, 0);
+            if (score >= probcut_beta)
+            {
+                score = -negaMax(-probcut_beta, -probcut_beta + 1, depth - 4, ply + 1, 0);
+            }
+            unmakeMove();
+            if (search_stopped)
+                return TIMEOUT;
+            if (score >= probcut_beta)
+            {
+                storeTTentry(global_posHash, move, depth - 3, probcut_beta, CUT_NODE, ply);
+                return beta;
+            }
+        }
+    }
 
-    const int NULL_MOVE_REDUCTION = 2; // reduce search depth by 2 for the null-move search
-    if (canMakeNullMove(depth, kingInCheck, isEndgame()))
+    /*
+    singular extension : when the TT says the TT move fails high at about this depth, search every other move at half the
+    depth against a bound a little below the TT score. If none of them gets there the TT move is singular, the only move
+    holding the position, and it gets searched one ply deeper. If even the bound below the TT score beats beta, several
+    moves fail high and the node is cut right away (multi-cut).
+    Exact and cut-node entries are lower bounds on the TT move's score, all-node ones aren't.
+    */
+    int singular_extension = 0;
+    if (ply > 0 && !excluded && tt_move && depth >= SE_MIN_DEPTH && tt_node_type != ALL_NODE &&
+        tt_depth >= depth - SE_TT_DEPTH_MARGIN && tt_eval > -MATE_BOUND && tt_eval < MATE_BOUND)
     {
-        makeNullMove();
-        int null_search_score = -negaMax(-beta, -beta + 1, depth - 1 - NULL_MOVE_REDUCTION, ply + 1);
-        unmakeNullMove();
-        if (null_search_score >= beta)
+        int singular_beta = tt_eval - singular_margin * depth;
+        int singular_score = negaMax(singular_beta - 1, singular_beta, (depth - 1) / 2, ply, tt_move);
+        if (search_stopped)
+            return TIMEOUT;
+        if (singular_score < singular_beta)
+        {
+            singular_extension = 1;
+        }
+        else if (singular_beta >= beta)
         {
             return beta;
         }
     }
 
-    // end of null move pruning search
+    // a search leaving out the singular extension candidate doesn't store its result
+    bool store_tt = !excluded;
 
     // legal moves count, used to detect stalemate and checkmate
     int legal_moves = 0;
@@ -2741,14 +4223,23 @@ static inline int negaMax(int alpha, int beta, int depth, int ply)
     // create movelist and fill it with moves
     moves move_list[1];
     genMoves(&move_list[0]);
+    scoreMovesWithHistory(&move_list[0], tt_move, ply);
+    move_t quiets_searched[64]; // quiet moves that didn't cut off, they get a history malus when another move does
+    int quiet_count = 0;
 
-    // loop over moves within a movelist
+    // loop over moves within a movelist : TT move, captures by MVV-LVA, countermove, then quiet moves by history
 
     for (int count = 0; count < move_list->total_count; count++)
     {
+        move_t move = pickNextMove(&move_list[0], count);
+        if (move == excluded)
+        {
+            continue;
+        }
 
+        int moving_piece = piece_on_square[getSourceSq(move)];
         // make sure to make only legal moves
-        if (makeMove(move_list->moves[count]) == 0)
+        if (makeMove(move) == 0)
         {
 
             // skip to next move
@@ -2758,20 +4249,50 @@ static inline int negaMax(int alpha, int beta, int depth, int ply)
         // increment legal moves
         legal_moves++;
 
+        // futility pruning, the move is legal so it still counts against mate and stalemate
+        if (futile && !(getFlags(move) & 0b1100) && !isInCheck())
+        {
+            unmakeMove();
+            continue;
+        }
+
         // score current move
-        int score = -negaMax(-beta, -alpha, depth - 1, ply + 1);
+        search_ctx.stack[ply].move = move;
+        search_ctx.stack[ply].piece = moving_piece;
+        int extension = (move == tt_move) ? singular_extension : 0;
+        int score = -negaMax(-beta, -alpha, depth - 1 + extension, ply + 1, 0);
 
         unmakeMove();
+        if (search_stopped) // the score is meaningless, unwind without touching the TT or the history
+        {
+            return TIMEOUT;
+        }
+
+        bool quiet = !(getFlags(move) & 0b1100);
 
         // beta cut-off occurs, move fails high
         if (score >= beta)
         {
-            if (ply == 0)
-                currBest = move_list->moves[count];
-            // publish root best move if applicable
-            if (ply == 0 && currBest != 0)
-                best_move = currBest;
-            storeTTentry(global_posHash, currBest, depth, beta, 1);
+            cutoffs++;
+            if (legal_moves == 1)
+                first_move_cutoffs++;
+            if (quiet)
+            {
+                // reward the cutoff move and punish the quiet moves that were searched before it and failed
+                int bonus = (depth * depth * 16 < 1200) ? depth * depth * 16 : 1200;
+                updateQuietHistory(ply, move, bonus);
+                for (int i = 0; i < quiet_count; i++)
+                {
+                    updateQuietHistory(ply, quiets_searched[i], -bonus);
+                }
+                if (ply > 0 && search_ctx.stack[ply - 1].move)
+                {
+                    search_ctx.counter_moves[search_ctx.stack[ply - 1].piece][getTargetSq(search_ctx.stack[ply - 1].move)] = move;
+                }
+            }
+            currBest = move;
+            if (store_tt)
+                storeTTentry(global_posHash, currBest, depth, beta, CUT_NODE, ply);
 
             return beta;
         }
@@ -2781,11 +4302,27 @@ static inline int negaMax(int alpha, int beta, int depth, int ply)
         {
             alpha = score;
 
-            // if root move
-            if (ply == 0)
-                // associate best move with the best score
-                currBest = move_list->moves[count];
+            // associate best move with the best score, it becomes the TT move of this position
+            currBest = move;
+
+            // this move followed by the child's line is the new PV from this ply
+            pv_table[ply][ply] = move;
+            for (int next = ply + 1; next < pv_length[ply + 1]; next++)
+            {
+                pv_table[ply][next] = pv_table[ply + 1][next];
+            }
+            pv_length[ply] = pv_length[ply + 1];
         }
+        if (quiet && quiet_count < 64)
+        {
+            quiets_searched[quiet_count++] = move;
+        }
+    }
+
+    // only the excluded move was legal, that says nothing about mate or stalemate
+    if (legal_moves == 0 && excluded)
+    {
+        return alpha;
     }
 
     // if no legal moves, check for stalemate/checkmate
@@ -2796,7 +4333,7 @@ static inline int negaMax(int alpha, int beta, int depth, int ply)
         {
 
             // store mate in TT
-            storeTTentry(global_posHash, 0, depth, -MATE + ply, 0);
+            storeTTentry(global_posHash, 0, depth, -MATE + ply, PV_NODE, ply);
 
             // return mating
 
@@ -2807,246 +4344,883 @@ static inline int negaMax(int alpha, int beta, int depth, int ply)
         else
         {
             // store stalemate in TT
-            storeTTentry(global_posHash, 0, depth, 0, 0);
+            storeTTentry(global_posHash, 0, depth, 0, PV_NODE, ply);
             // return draw score, which is 0.
             return 0;
         }
     }
 
-    // alpha changed, which means a better move has been found. magnificent.
-    if (prevAlpha != alpha && ply == 0 && currBest != 0)
-    {
-        best_move = currBest;
-    }
-
     int node_type;
 
     if (alpha != prevAlpha)
     {
-        node_type = ALL_NODE; // new alpha is better, this is a fail-low node as alpha is low.
+        node_type = PV_NODE; // a move raised alpha without reaching beta, its score is exact
     }
     else
     {
-        node_type = PV_NODE; // node type is exact score if none of the other conditions are true
+        node_type = ALL_NODE; // fail low, no move got above alpha so it is only an upper bound
     }
 
-    storeTTentry(global_posHash, best_move, depth, alpha, node_type);
+    if (store_tt) // the score of a search without some of the moves would pollute the TT
+        storeTTentry(global_posHash, currBest, depth, alpha, node_type, ply);
     return alpha; // node is fail low if control flow reaches here, return guaranteed minimum.
 }
 
 /*
 function which will print the best move so it can be sent through the UCI protocol
 */
-void searchPos() // the function which will provide the lichess-bot api with the best string.
-// note : max_time is in milliseconds, and so is everything else time related.
+/*
+The root has its own move list. Legality is checked once when it is built, and "go searchmoves" restricts it. After each
+iteration the list is reordered : the moves of the PV lines first, then the others by the number of nodes their subtree
+took, since a move that is hard to refute is usually a good one. The PV lines are the only moves with an exact score, and
+their MultiPV rank already orders them by it. The search is fail hard, so every other move comes back with just the alpha
+of the moment it was searched, which says nothing about the move itself, and no score is kept for them.
+*/
+typedef struct
 {
-    int start = getTime();
-    int score = 0;     // to send through UCI with "info" command
-    int lastDepth = 0; // to record last depth searched to send through UCI with "info" command
-    nodes = 0;         // reset node count for new search
-    best_move = 0;     // clear existing best_move
-    int lastScore = 0;
-    for (int depth = 1; depth <= 5; depth++) // iterative deepening , keep searching before time runs out
+    move_t move;
+    long long nodes; // nodes spent below this move over the whole search
+} root_move;
+
+root_move root_moves[MAX_MOVES];
+int root_move_count = 0;
+move_t search_moves[MAX_MOVES]; // moves given with "go searchmoves", the root only searches these when there are any
+int search_move_count = 0;
+
+void initRootMoves()
+{
+    moves move_list;
+    genMoves(&move_list);
+    root_move_count = 0;
+    for (int i = 0; i < move_list.total_count; i++)
     {
-        score = negaMax(-MATE, MATE, depth, 0);
-        if (score == TIMEOUT)
+        move_t move = getMove(move_list.entries[i]);
+        if (leavesKingInCheck(move))
+            continue;
+        bool allowed = (search_move_count == 0);
+        for (int j = 0; j < search_move_count && !allowed; j++)
         {
-            break;
+            allowed = (search_moves[j] == move);
         }
-        lastScore = score;
-        lastDepth = depth;
+        if (!allowed)
+            continue;
+        root_moves[root_move_count].move = move;
+        root_moves[root_move_count].nodes = 0;
+        root_move_count++;
+    }
+}
 
-        if (timedOut())
+void sortRootMoves(int lines) // PV lines first in rank order, then the rest by subtree size, stable insertion sort
+{
+    for (int i = 1; i < root_move_count; i++)
+    {
+        root_move current = root_moves[i];
+        int current_rank = lines;
+        for (int k = 0; k < lines; k++)
         {
-            break;
+            if (root_excluded[k] == current.move)
+                current_rank = k;
+        }
+        int j = i - 1;
+        while (j >= 0)
+        {
+            int rank = lines;
+            for (int k = 0; k < lines; k++)
+            {
+                if (root_excluded[k] == root_moves[j].move)
+                    rank = k;
+            }
+            if (rank < current_rank || (rank == current_rank && (rank < lines || root_moves[j].nodes >= current.nodes)))
+                break;
+            root_moves[j + 1] = root_moves[j];
+            j--;
         }
+        root_moves[j + 1] = current;
     }
+}
 
-    if (best_move)
+static int searchRoot(int alpha, int beta, int depth) // search the root move list, skipping the moves of higher MultiPV lines
+{
+    pv_length[0] = 0;
+    nodes++;
+    if (isInCheck())
     {
-        int flags = getFlags(best_move);
-        if (flags & 0b1000) // If move is a promotion
+        depth++; // same check extension as every other node
+    }
+    for (int i = 0; i < root_move_count; i++)
+    {
+        move_t move = root_moves[i].move;
+        if (isRootExcluded(move))
+            continue;
+        search_ctx.stack[0].move = move;
+        search_ctx.stack[0].piece = piece_on_square[getSourceSq(move)];
+        long long nodes_before = nodes;
+        if (!makeMove(move)) // only an illegal starting position (side not to move in check) can get here
+            continue;
+        int score = -negaMax(-beta, -alpha, depth - 1, 1, 0);
+        unmakeMove();
+        root_moves[i].nodes += nodes - nodes_before;
+        if (search_stopped)
         {
-            char promo_char = 'q'; // Default to queen
-            switch (flags & 0b1111)
-            {
-            case 0b1000:
-            case 0b1100:
-                promo_char = 'n';
-                break;
-            case 0b1001:
-            case 0b1101:
-                promo_char = 'b';
-                break;
-            case 0b1010:
-            case 0b1110:
-                promo_char = 'r';
-                break;
-            case 0b1011:
-            case 0b1111:
-                promo_char = 'q';
-                break;
-            }
-            printf("bestmove %s%s%c\n",
-                   square_to_coords[getSourceSq(best_move)],
-                   square_to_coords[getTargetSq(best_move)],
-                   promo_char);
-            fflush(stdout);
+            return TIMEOUT;
         }
-        else
+        if (score > alpha)
         {
-            printf("bestmove %s%s\n",
-                   square_to_coords[getSourceSq(best_move)],
-                   square_to_coords[getTargetSq(best_move)]);
-            fflush(stdout);
+            alpha = score;
+            pv_table[0][0] = move;
+            for (int next = 1; next < pv_length[1]; next++)
+            {
+                pv_table[0][next] = pv_table[1][next];
+            }
+            pv_length[0] = pv_length[1];
         }
     }
+    return alpha;
+}
+
+void printPV(int depth, int rank, int score, int start) // print one "info" line for the principal variation in pv_table[0]
+{
+    // nps is computed with at least 1 ms elapsed to avoid dividing by 0
+    int elapsed = getTime() - start;
+    // mates are reported in moves as "score mate n", negative when we are the one getting mated
+    if (score > MATE_BOUND)
+        printf("info depth %d multipv %d score mate %d", depth, rank, (MATE - score + 1) / 2);
+    else if (score < -MATE_BOUND)
+        printf("info depth %d multipv %d score mate %d", depth, rank, -(MATE + score) / 2);
     else
+        printf("info depth %d multipv %d score cp %d", depth, rank, score);
+    printf(" nodes %lld qnodes %lld time %d nps %lld hashfull %d pv", nodes, qnodes, elapsed, nodes * 1000 / (elapsed > 0 ? elapsed : 1),
+           hashFull());
+    char move_string[6];
+    for (int i = 0; i < pv_length[0]; i++)
     {
-        printf("bestmove 0000\n");
+        moveToString(pv_table[0][i], move_string);
+        printf(" %s", move_string);
     }
-    // printf("info depth %d score cp %d nodes %d time %d\n", lastDepth, lastScore, nodes, getTime() - start);
-    // fflush(stdout);
+    printf("\n");
+}
+
+/*
+With MultiPV set to n, every iteration searches the root n times. Each search excludes the root moves of the lines found
+before it, so the k-th search finds the k-th best move and its line. The TT is shared between them, so the later lines
+are mostly TT hits. The best move is the first line of the last iteration that was completed.
+*/
+int searchPos(int max_depth) // the function which will provide the lichess-bot api with the best string, returns the last completed score.
+// note : max_time is in milliseconds, and so is everything else time related.
+{
+    int start = getTime();
+    int score = 0; // to send through UCI with "info" command
+    nodes = 0;     // reset node count for new search
+    qnodes = 0;
+    cutoffs = 0;
+    first_move_cutoffs = 0;
+    // entries of the previous searches can now be replaced by anything, a shared table counts the searches of every process
+    tt_age = tt_shared_age ? __atomic_add_fetch(tt_shared_age, 1, __ATOMIC_RELAXED) : (uint16_t)(tt_age + 1);
+    tt_probes = 0;
+    tt_hits = 0;
+    tt_cutoffs = 0;
+    tt_move_hits = 0;
+    nmp_min_ply = 0;
+    search_stopped = false;
+    best_move = 0; // clear existing best_move
+    completed_depth = 0;
+    int stability = 0; // iterations in a row that ended with the same best move
+
+    initRootMoves();
+    search_move_count = 0; // "searchmoves" only applies to the search it came with
+    int lines = (root_move_count < multi_pv) ? root_move_count : multi_pv; // there can't be more lines than legal moves
+    if (root_move_count == 0)
+    {
+        score = isInCheck() ? -MATE : 0;
+    }
+
+    for (int depth = 1; depth <= max_depth && lines > 0; depth++) // iterative deepening , keep searching before time runs out
+    {
+        bool completed = true;
+        for (int rank = 0; rank < lines; rank++)
+        {
+            root_excluded_count = rank; // the moves of the lines above this one are left out at the root
+            int result = searchRoot(-MATE, MATE, depth);
+            if (result == TIMEOUT)
+            {
+                completed = false;
+                break;
+            }
+            if (pv_length[0] == 0) // no move improved alpha, nothing to report for this line
+            {
+                break;
+            }
+            root_excluded[rank] = pv_table[0][0];
+            if (rank == 0)
+            {
+                score = result;
+                stability = (pv_table[0][0] == best_move) ? stability + 1 : 0;
+                best_move = pv_table[0][0];
+            }
+            printPV(depth, rank + 1, result, start);
+        }
+        root_excluded_count = 0;
+        if (!completed)
+        {
+            break;
+        }
+        completed_depth = depth;
+        sortRootMoves(lines);
+
+        // a best move that keeps changing earns more time, one that has been the same for a few iterations less
+        int elapsed = getTime() - start;
+        long long soft_limit = (long long)soft_time_limit * ((stability >= 4) ? 50 : (stability >= 2) ? 80 : (stability == 0 && depth > 1) ? 150 : 100) / 100;
+        if (timedOut() || (soft_time_limit != INFINITE_TIME && elapsed >= soft_limit))
+        {
+            break;
+        }
+    }
+    if (infinite_search)
+    {
+        waitForStop();
+    }
+    if (best_move == 0 && root_move_count > 0) // not even depth 1 finished, play the first legal move rather than nothing
+    {
+        best_move = root_moves[0].move;
+    }
+
+    // how often the first move searched already caused the cutoff, the closer to 100% the better the move ordering
+    printf("info string first move cutoffs %.1f%% of %lld\n", cutoffs ? 100.0 * first_move_cutoffs / cutoffs : 0.0, cutoffs);
+    // TT hits, and the part of them that ended the node or at least gave the move to search first
+    printf("info string tt probes %lld hits %.1f%% cutoffs %.1f%% move hits %.1f%%\n", tt_probes,
+           tt_probes ? 100.0 * tt_hits / tt_probes : 0.0, tt_hits ? 100.0 * tt_cutoffs / tt_hits : 0.0,
+           tt_hits ? 100.0 * tt_move_hits / tt_hits : 0.0);
+
+    if (best_move)
+    {
+        char move_string[6];
+        moveToString(best_move, move_string);
+        printf("bestmove %s\n", move_string);
+    }
+    else
+    {
+        printf("bestmove 0000\n");
+    }
+    fflush(stdout);
+    return score;
+}
+
+
+/******************\
+--------------------
+    Initialization
+--------------------
+\******************/
+
+/*
+here, we create a function which will accept a FEN string as input and initialize the
+current position into our piece bitboard.
+*/
+void initFENPosition(char *FEN)
+{
+    // erase data from piece and occupancy bitboards, and also reset piece_on_square board
+    for (int square = 0; square < 64; square++)
+    {
+        piece_on_square[square] = no_piece;
+    }
+    memset(piece_bitboards, 0ULL, sizeof(piece_bitboards));
+    memset(occupancy_bitboards, 0ULL, sizeof(occupancy_bitboards));
+    int current_index = 0;
+    // reset castle, en_passant, and global position hash
+    castle = 0;
+    en_passant = no_sq;
+    global_posHash = 0;
+    // a new position starts with empty undo and repetition stacks, game moves will be pushed onto them by parsePosition()
+    undo_stack_count = 0;
+    repetition_idx = 0;
+    int square;
+
+    for (int rank = 0; rank < 8; rank++)
+    {
+        for (int file = 0; file < 8; file++)
+        {
+            square = rank * 8 + file;
+            if (FEN[current_index] == '/')
+            {
+                current_index++;
+            }
+
+            if (FEN[current_index] >= '1' && FEN[current_index] <= '8')
+            {
+                file += FEN[current_index] - '0' - 1;
+            }
+            else
+            {
+                setBit(piece_bitboards[pieces_to_encoded_constant[FEN[current_index]]], square);
+                piece_on_square[square] = pieces_to_encoded_constant[FEN[current_index]];
+            }
+            current_index++;
+        }
+    }
+    current_index++;
+    /*
+    I decided to use strncpy() and sscanf() to read the rest of the FEN string to initialize game state variables.
+    One advantage of this approach is that its more compact compared to manually incrementing current_index and reading the string
+    at each step with if/else statements
+
+    One disadvantage (which had me debugging for a bit) is that it will initialize extremely incorrect game state variables when
+    given an incomplete FEN string, for example :
+     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR"
+     The starting position, but without any of the game state information and only the board information
+     When debugging, I'd see that half-moves was set to something like -81555201...
+     So overall, this function depends on being given a complete and well-formatted string, or else bugs will surely be encountered.
+    */
+    char rest_of_FEN[64];
+    strncpy(rest_of_FEN, &FEN[current_index], sizeof(rest_of_FEN) - 1);
+    rest_of_FEN[sizeof(rest_of_FEN) - 1] = '\0';
+
+    char side_from_FEN;
+    char castle_from_FEN[5];
+    char en_passant_str[3];
+    int half_moves_from_FEN;
+    int full_moves_from_FEN;
+
+    sscanf(rest_of_FEN, "%c %4s %2s %d %d", &side_from_FEN, castle_from_FEN, en_passant_str, &half_moves_from_FEN, &full_moves_from_FEN);
+
+    /*
+    debug print statements
+    printf("side %c\n", side_from_FEN);
+    printf("castle %s\n", castle_from_FEN);
+    printf("ep %s\n", en_passant_str);
+    printf("half %d\n", half_moves_from_FEN);
+    printf("full %d\n", full_moves_from_FEN);
+    */
+
+    side = (side_from_FEN == 'w') ? white : black;
+
+    for (int index = 0; index < 4; index++)
+    {
+        char curr = castle_from_FEN[index];
+        if (curr != 'Q' && curr != 'K' && curr != 'k' && curr != 'q')
+        {
+            break;
+        }
+        castle |= castle_rights_encoder[curr];
+    }
+
+    if (strcmp(en_passant_str, "-") == 0)
+    {
+        en_passant = no_sq;
+    }
+    else
+    {
+        int file = files_to_int[en_passant_str[0]];
+        int rank = 8 - (en_passant_str[1] - '0');
+        en_passant = rank * 8 + file;
+    }
+
+    half_moves = half_moves_from_FEN;
+    full_moves = full_moves_from_FEN;
+    // reset occupancies of black and white
+    occupancy_bitboards[white] = 0ULL;
+    occupancy_bitboards[black] = 0ULL;
+    // use piece bitboards to fill occupancy bitboards
+    for (int piece = P; piece <= K; piece++)
+    {
+        occupancy_bitboards[white] |= piece_bitboards[piece];
+    }
+    for (int piece = p; piece <= k; piece++)
+    {
+        occupancy_bitboards[black] |= piece_bitboards[piece];
+    }
+    // use occupancy bitboards of black and white to fill occupancy bitboards for both sides
+    occupancy_bitboards[both] = occupancy_bitboards[white] | occupancy_bitboards[black];
+    // generate hash for position
+    global_posHash = genPositionHash();
+}
+
+void initEverything()
+{
+    // search parameters start at their defaults, "setoption" may change them later
+    resetTunables();
+#ifndef GENERATED_TABLES
+    // initialize leaper (pawn, knight, king) attacks
+    initLeaperAttacks();
+
+    // initialize slider attacks
+    initSliderAttacks(bishop);
+    initSliderAttacks(rook);
+#endif
+    // pick the pext backend for slider attacks if the CPU has a fast pext instruction
+    detectPext();
+    if (pext_available)
+    {
+#ifndef GENERATED_TABLES
+        initPextAttacks();
+#endif
+        use_pext = true;
+    }
+#ifndef GENERATED_TABLES
+    // initialize zobrist pseudorandom numbers
+    initZobristNums();
+#endif
+    // initalize magic numbers (not used since magics have been hard coded in)
+    // initMagicNumbers();
+    // allocate transposition table
+    initTT(DEFAULT_HASH_MB);
+    // start from the initial position so commands like "perft" work before any "position" command
+    initFENPosition(starting_postition_fen);
+}
+
+/*
+The "gentables" command prints every table filled by initEverything() as const C data. The makefile compiles it into
+generated_tables.c, which the engine includes instead of computing the tables when built with -DGENERATED_TABLES.
+*/
+void printTable(char *declaration, const U64 *table, int rows, int columns) // print a 1D (rows == 1) or 2D table as a C array definition
+{
+    printf("%s = {", declaration);
+    for (int row = 0; row < rows; row++)
+    {
+        if (rows > 1)
+        {
+            printf("%s\n{", row ? "," : "");
+        }
+        for (int i = 0; i < columns; i++) // 4 entries per line
+        {
+            printf("%s0x%llxULL", (i % 4) ? ", " : (i ? ",\n    " : "\n    "), (unsigned long long)table[row * columns + i]);
+        }
+        if (rows > 1)
+        {
+            printf("}");
+        }
+    }
+    printf("};\n\n");
+}
+
+void printPextPointers(char *declaration, const U64 *const *pointers) // print the per square pointers into the dense pext table
+{
+    printf("%s = {", declaration);
+    for (int square = 0; square < 64; square++)
+    {
+        printf("%spext_attack_table + %d", (square % 4) ? ", " : (square ? ",\n    " : "\n    "), (int)(pointers[square] - pext_attack_table));
+    }
+    printf("};\n\n");
+}
+
+void printTables()
+{
+#ifndef GENERATED_TABLES
+    // the pext table is only filled on CPUs with pext, but the generated file has to work for every CPU
+    initPextAttacks();
+#endif
+    printf("/* generated by \"superjelly.exe gentables\", do not edit */\n\n");
+    printTable("const U64 pawn_attacks[2][64]", &pawn_attacks[0][0], 2, 64);
+    printTable("const U64 knight_attacks[64]", knight_attacks, 1, 64);
+    printTable("const U64 king_attacks[64]", king_attacks, 1, 64);
+    printTable("const U64 bishop_masks[64]", bishop_masks, 1, 64);
+    printTable("const U64 rook_masks[64]", rook_masks, 1, 64);
+    printTable("const U64 bishop_attacks[64][512]", &bishop_attacks[0][0], 64, 512);
+    printTable("const U64 rook_attacks[64][4096]", &rook_attacks[0][0], 64, 4096);
+    printTable("const U64 pext_attack_table[107648]", pext_attack_table, 1, 107648);
+    printPextPointers("const U64 *const rook_pext_attacks[64]", (const U64 *const *)rook_pext_attacks);
+    printPextPointers("const U64 *const bishop_pext_attacks[64]", (const U64 *const *)bishop_pext_attacks);
+    printTable("const U64 zobristNums[793]", zobristNums, 1, 793);
+    fflush(stdout);
+}
+
+/******************\
+--------------------
+    Perft Suite
+--------------------
+\******************/
+/*
+The standard perft positions with their known node counts. Together they cover castling (and losing castling rights),
+en-passant (including the illegal ones exposing the king), promotions and underpromotions, checks and pins.
+Depths are chosen so the whole suite takes a few seconds.
+*/
+typedef struct
+{
+    char *fen;
+    int depth;
+    long long nodes;
+} perft_test;
+
+// clang-format off
+perft_test perft_suite[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},                   // starting position
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},       // kiwipete
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624},                                   // en-passant and pins
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},            // promotions and castling
+    {"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 4, 422333},            // same, mirrored
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},                  // promotion captures
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594}, // middlegame
+    {"n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", 5, 3605103},                                    // promotions for both sides
+    {"3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888},                                          // illegal en-passant
+    {"8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 6, 1015133},                                         // illegal en-passant
+    {"8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},                                        // en-passant capture checks
+    {"5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},                                              // short castling gives check
+    {"3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},                                              // long castling gives check
+    {"r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},                                  // castling rights
+    {"r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},                                   // castling prevented
+    {"2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001},                                          // promote out of check
+    {"8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", 5, 1004658},                                        // discovered check
+    {"4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},                                              // promote to give check
+    {"8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},                                                // underpromote to give check
+    {"K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},                                                 // self stalemate
+    {"8/k1P5/8/1K6/8/8/8/8 w - - 0 1", 7, 567584},                                              // stalemate and checkmate
+    {"8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527}                                             // stalemate and checkmate
+};
+// clang-format on
+
+void perftSuite(int threads) // run every position of perft_suite[] and compare against the known node counts
+{
+    int test_count = sizeof(perft_suite) / sizeof(perft_suite[0]);
+    int failed = 0;
+    long long total = 0;
+
+    int start = getTime();
+    for (int i = 0; i < test_count; i++)
+    {
+        initFENPosition(perft_suite[i].fen);
+        long long count = perftRoot(perft_suite[i].depth, threads, false);
+        total += count;
+        if (count != perft_suite[i].nodes)
+        {
+            failed++;
+        }
+        printf("%s perft %d : %lld (expected %lld) %s\n", perft_suite[i].fen, perft_suite[i].depth, count, perft_suite[i].nodes,
+               (count == perft_suite[i].nodes) ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+    printf("\n%d/%d passed\n", test_count - failed, test_count);
+    printPerftSpeed(total, getTime() - start);
+    initFENPosition(starting_postition_fen);
+}
+
+/******************\
+--------------------
+   Test Searches
+--------------------
+\******************/
+/*
+bench, the suites and sortbench all search a list of positions the same way : on a table of their own (see setAsideTT()),
+each position from an empty table and empty history so the results are the same on every run, and the engine is back on
+the GUI's table and the start position afterwards.
+*/
+void beginTestSearches(int megabytes)
+{
+    setAsideTT(megabytes);
+}
+
+void startTestPosition(char *fen) // set up fen with nothing learned from the previous positions
+{
+    initFENPosition(fen);
+    clearTT();
+    clearHistory();
+    startTimer(INFINITE_TIME);
+}
+
+void endTestSearches()
+{
+    restoreTT();
+    initFENPosition(starting_postition_fen);
+}
+
+/******************\
+--------------------
+     Mate Suite
+--------------------
+\******************/
+/*
+Positions with a known forced mate, searched to exactly the depth the mate needs (2 * mate_in - 1 plies) on an empty
+transposition table. A position passes when the search comes back with the score of a mate in mate_in. The time and node
+count to get there are what check extensions and mate distance pruning are supposed to improve.
+
+Each position is then searched again two plies deeper on the same table, which has to report the very same mate. The deeper
+iterations read back mate scores stored at other plies, so this is what catches mate distances that are off because of
+the TT : the queen and rook mates at the end were reported as a move shorter than they are before scores were stored
+relative to the node. The mate distances of those were checked with a plain full width search.
+*/
+typedef struct
+{
+    char *fen;
+    int mate_in;
+} mate_test;
+
+// clang-format off
+mate_test mate_suite[] = {
+    {"6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", 1},                                              // back rank mate
+    {"r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4", 1},           // scholar's mate
+    {"6rk/6pp/8/4N3/8/8/8/6K1 w - - 0 1", 1},                                              // smothered mate
+    {"r5k1/8/8/8/8/8/5PPP/6K1 b - - 0 1", 1},                                              // back rank mate for black
+    {"6k1/8/8/8/8/8/R7/1R4K1 w - - 0 1", 2},                                               // rook ladder
+    {"5r1k/6pp/7N/3Q4/8/8/8/6K1 w - - 0 1", 2},                                            // queen sacrifice into smothered mate
+    {"r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 1", 2},             // knight check then bishop mate
+    {"kbK5/pp6/1P6/8/8/8/8/R7 w - - 0 1", 2},                                              // quiet rook move
+    {"8/8/8/8/8/4K3/R7/7k w - - 0 1", 3},                                                  // king and rook against king
+    {"r5rk/5p1p/5R2/4B3/8/8/7P/7K w - - 0 1", 3},                                          // rook swing along the sixth rank
+    {"r1b1kb1r/pppp1ppp/5q2/4n3/3KP3/2N3PN/PPP4P/R1BQ1B1R b kq - 0 1", 3},                 // king hunt for black
+    {"8/8/8/8/2k5/8/8/QR4K1 w - - 0 1", 4},                                                // queen and rook against king
+    {"8/8/8/3k4/8/8/8/QR4K1 w - - 0 1", 5},                                                // queen and rook, king in the center
+    {"8/8/8/8/3k4/8/8/QR4K1 w - - 0 1", 5},                                                // queen and rook, king in the center
+    {"8/8/8/3k4/8/8/8/RR4K1 w - - 0 1", 6}                                                 // two rooks against king
+};
+// clang-format on
+
+void mateSuite()
+{
+    int test_count = sizeof(mate_suite) / sizeof(mate_suite[0]);
+    int failed = 0;
+    long long total_nodes = 0;
+    beginTestSearches(BENCH_DEFAULT_HASH_MB);
+
+    int start = getTime();
+    for (int i = 0; i < test_count; i++)
+    {
+        int depth = 2 * mate_suite[i].mate_in - 1;
+        startTestPosition(mate_suite[i].fen);
+        int position_start = getTime();
+        int score = searchPos(depth);
+        total_nodes += nodes;
+        int deeper_score = searchPos(depth + 2); // keeps the TT of the first search
+        total_nodes += nodes;
+        int elapsed = getTime() - position_start;
+        bool solved = (score == MATE - depth && deeper_score == MATE - depth);
+        if (!solved)
+        {
+            failed++;
+        }
+        printf("%s mate in %d : %s, %d ms\n", mate_suite[i].fen, mate_suite[i].mate_in, solved ? "ok" : "FAILED", elapsed);
+        fflush(stdout);
+    }
+    int elapsed = getTime() - start;
+    printf("\n%d/%d solved\n", test_count - failed, test_count);
+    printf("Nodes: %lld Time: %d ms\n", total_nodes, elapsed);
+    fflush(stdout);
+
+    endTestSearches();
+}
+
+/******************\
+--------------------
+        Bench
+--------------------
+\******************/
+/*
+"bench" searches a fixed list of positions to a fixed depth, each one starting from an empty transposition table.
+Nothing in it depends on time, so the total node count is the same on every run and every host. That makes it a
+signature of the search : a change that changes the node count changes how the engine searches, and a change that
+keeps it (a speedup, a refactor) provably doesn't. The nps on the other hand lets us compare builds and hosts.
+
+The positions are the well known bench positions used by many engines : openings, middlegames, endgames,
+and a few mates and stalemates at the end.
+*/
+// clang-format off
+char *bench_positions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+    "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+    "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+    "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+    "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+    "8/8/8/8/8/6k1/6p1/6K1 w - - 0 1",
+    "7k/7P/6K1/8/3B4/8/8/8 b - - 0 1"
+};
+// clang-format on
+
+void bench(int depth, int threads, int hash_mb)
+{
+    int position_count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+    long long total_nodes = 0;
+    long long total_qnodes = 0;
+    long long total_cutoffs = 0, total_first_move_cutoffs = 0;
+
+    if (threads != 1) // the search is single threaded, say so instead of silently ignoring the argument
+    {
+        printf("info string search is single threaded, bench runs with 1 thread\n");
+    }
+    beginTestSearches(hash_mb);
+    printf("info string slider attacks use %s\n", use_pext ? "pext" : "magic bitboards");
+    printTTInfo();
+
+    int start = getTime();
+    for (int i = 0; i < position_count; i++)
+    {
+        printf("\nPosition: %d/%d %s\n", i + 1, position_count, bench_positions[i]);
+        startTestPosition(bench_positions[i]);
+        searchPos(depth);
+        total_nodes += nodes;
+        total_qnodes += qnodes;
+        total_cutoffs += cutoffs;
+        total_first_move_cutoffs += first_move_cutoffs;
+    }
+    int elapsed = getTime() - start;
+
+    printf("\n===========================\n");
+    printf("Total time (ms) : %d\n", elapsed);
+    printf("Nodes searched  : %lld\n", total_nodes);
+    printf("Qsearch nodes   : %lld\n", total_qnodes);
+    printf("First move cut  : %.1f%%\n", total_cutoffs ? 100.0 * total_first_move_cutoffs / total_cutoffs : 0.0);
+    printf("Nodes/second    : %lld\n", total_nodes * 1000 / (elapsed > 0 ? elapsed : 1));
+    fflush(stdout);
+
+    endTestSearches();
+}
+
+void parseBench(char *input) // parse "bench [depth] [threads] [hash]", every argument being optional
+{
+    int depth = BENCH_DEFAULT_DEPTH;
+    int threads = 1;
+    int hash_mb = BENCH_DEFAULT_HASH_MB;
+    sscanf(input + 5, "%d %d %d", &depth, &threads, &hash_mb); // move pointer forward to skip "bench" text
+    if (depth < 1)
+        depth = 1;
+    if (depth > MAX_DEPTH)
+        depth = MAX_DEPTH;
+    if (hash_mb < 1)
+        hash_mb = 1;
+    if (hash_mb > MAX_HASH_MB)
+        hash_mb = MAX_HASH_MB;
+    bench(depth, threads, hash_mb);
 }
 
+#ifdef SORT_TRACE
 /******************\
 --------------------
-    Initialization
+     Sort Bench
 --------------------
 \******************/
-
 /*
-here, we create a function which will accept a FEN string as input and initialize the
-current position into our piece bitboard.
+"sortbench" compares move ordering strategies on real move lists. It searches the bench positions with tracing on to
+collect quiescence move lists, then replays them : once with the full bubble sort we used to do before searching any move,
+and once with pickNextMove() stopping after as many moves as the traced node actually searched. Both sum the scores of
+the moves they hand out, which has to match since both hand out moves in score order.
 */
-void initFENPosition(char *FEN)
-{
-    // erase data from piece and occupancy bitboards, and also reset piece_on_square board
-    for (int square = 0; square < 64; square++)
-    {
-        piece_on_square[square] = no_piece;
-    }
-    memset(piece_bitboards, 0ULL, sizeof(piece_bitboards));
-    memset(occupancy_bitboards, 0ULL, sizeof(occupancy_bitboards));
-    int current_index = 0;
-    // reset castle, en_passant, and global position hash
-    castle = 0;
-    en_passant = no_sq;
-    global_posHash = 0;
-    int square;
+#define SORT_BENCH_ROUNDS 20
 
-    for (int rank = 0; rank < 8; rank++)
+static void bubbleSortMoves(moves *move_list) // the previous sortMoves(), kept as the reference point for sortbench
+{
+    int move_count = move_list->total_count;
+    for (int currMoveIndex = 0; currMoveIndex < move_count; currMoveIndex++)
     {
-        for (int file = 0; file < 8; file++)
+        for (int nextMoveIndex = currMoveIndex + 1; nextMoveIndex < move_count; nextMoveIndex++)
         {
-            square = rank * 8 + file;
-            if (FEN[current_index] == '/')
-            {
-                current_index++;
-            }
-
-            if (FEN[current_index] >= '1' && FEN[current_index] <= '8')
-            {
-                file += FEN[current_index] - '0' - 1;
-            }
-            else
+            if (getScore(move_list->entries[currMoveIndex]) < getScore(move_list->entries[nextMoveIndex]))
             {
-                setBit(piece_bitboards[pieces_to_encoded_constant[FEN[current_index]]], square);
-                piece_on_square[square] = pieces_to_encoded_constant[FEN[current_index]];
+                move_entry_t tempEntry = move_list->entries[currMoveIndex];
+                move_list->entries[currMoveIndex] = move_list->entries[nextMoveIndex];
+                move_list->entries[nextMoveIndex] = tempEntry;
             }
-            current_index++;
         }
     }
-    current_index++;
-    /*
-    I decided to use strncpy() and sscanf() to read the rest of the FEN string to initialize game state variables.
-    One advantage of this approach is that its more compact compared to manually incrementing current_index and reading the string
-    at each step with if/else statements
-
-    One disadvantage (which had me debugging for a bit) is that it will initialize extremely incorrect game state variables when
-    given an incomplete FEN string, for example :
-     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR"
-     The starting position, but without any of the game state information and only the board information
-     When debugging, I'd see that half-moves was set to something like -81555201...
-     So overall, this function depends on being given a complete and well-formatted string, or else bugs will surely be encountered.
-    */
-    char rest_of_FEN[64];
-    strncpy(rest_of_FEN, &FEN[current_index], sizeof(rest_of_FEN) - 1);
-    rest_of_FEN[sizeof(rest_of_FEN) - 1] = '\0';
-
-    char side_from_FEN;
-    char castle_from_FEN[5];
-    char en_passant_str[3];
-    int half_moves_from_FEN;
-    int full_moves_from_FEN;
-
-    sscanf(rest_of_FEN, "%c %4s %2s %d %d", &side_from_FEN, castle_from_FEN, en_passant_str, &half_moves_from_FEN, &full_moves_from_FEN);
-
-    /*
-    debug print statements
-    printf("side %c\n", side_from_FEN);
-    printf("castle %s\n", castle_from_FEN);
-    printf("ep %s\n", en_passant_str);
-    printf("half %d\n", half_moves_from_FEN);
-    printf("full %d\n", full_moves_from_FEN);
-    */
-
-    side = (side_from_FEN == 'w') ? white : black;
+}
 
-    for (int index = 0; index < 4; index++)
+void sortBench(int depth)
+{
+    sort_trace = malloc(sizeof(traced_list) * SORT_TRACE_SIZE);
+    if (sort_trace == NULL)
     {
-        char curr = castle_from_FEN[index];
-        if (curr != 'Q' && curr != 'K' && curr != 'k' && curr != 'q')
-        {
-            break;
-        }
-        castle |= castle_rights_encoder[curr];
+        printf("info string not enough memory for the sort trace\n");
+        return;
     }
-
-    if (strcmp(en_passant_str, "-") == 0)
+    sort_trace_count = 0;
+    beginTestSearches(BENCH_DEFAULT_HASH_MB);
+    int position_count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+    for (int i = 0; i < position_count && sort_trace_count < SORT_TRACE_SIZE; i++)
     {
-        en_passant = no_sq;
+        startTestPosition(bench_positions[i]);
+        searchPos(depth);
     }
-    else
+    traced_list *trace = sort_trace;
+    int count = sort_trace_count;
+    sort_trace = NULL; // stop tracing before replaying
+    endTestSearches();
+
+    long long total_moves = 0, total_picked = 0;
+    for (int i = 0; i < count; i++)
     {
-        int file = files_to_int[en_passant_str[0]];
-        int rank = 8 - (en_passant_str[1] - '0');
-        en_passant = rank * 8 + file;
+        total_moves += trace[i].list.total_count;
+        total_picked += trace[i].picked;
     }
 
-    half_moves = half_moves_from_FEN;
-    full_moves = full_moves_from_FEN;
-    // reset occupancies of black and white
-    occupancy_bitboards[white] = 0ULL;
-    occupancy_bitboards[black] = 0ULL;
-    // use piece bitboards to fill occupancy bitboards
-    for (int piece = P; piece <= K; piece++)
+    moves list;
+    long long bubble_sum = 0, pick_sum = 0;
+    int start = getTime();
+    for (int round = 0; round < SORT_BENCH_ROUNDS; round++)
     {
-        occupancy_bitboards[white] |= piece_bitboards[piece];
+        for (int i = 0; i < count; i++)
+        {
+            list.total_count = trace[i].list.total_count;
+            memcpy(list.entries, trace[i].list.entries, sizeof(move_entry_t) * list.total_count);
+            bubbleSortMoves(&list);
+            for (int j = 0; j < trace[i].picked; j++)
+            {
+                bubble_sum += getScore(list.entries[j]);
+            }
+        }
     }
-    for (int piece = p; piece <= k; piece++)
+    int bubble_time = getTime() - start;
+
+    start = getTime();
+    for (int round = 0; round < SORT_BENCH_ROUNDS; round++)
     {
-        occupancy_bitboards[black] |= piece_bitboards[piece];
+        for (int i = 0; i < count; i++)
+        {
+            list.total_count = trace[i].list.total_count;
+            memcpy(list.entries, trace[i].list.entries, sizeof(move_entry_t) * list.total_count);
+            for (int j = 0; j < trace[i].picked; j++)
+            {
+                pickNextMove(&list, j); // moves the best remaining entry into j
+                pick_sum += getScore(list.entries[j]);
+            }
+        }
     }
-    // use occupancy bitboards of black and white to fill occupancy bitboards for both sides
-    occupancy_bitboards[both] = occupancy_bitboards[white] | occupancy_bitboards[black];
-    // generate hash for position
-    global_posHash = genPositionHash();
-}
-
-void initEverything()
-{
-    // initialize leaper (pawn, knight, king) attacks
-    initLeaperAttacks();
+    int pick_time = getTime() - start;
+
+    printf("\n===========================\n");
+    printf("Move lists traced : %d (%.1f moves, %.1f picked on average)\n", count,
+           (double)total_moves / (count ? count : 1), (double)total_picked / (count ? count : 1));
+    printf("Bubble sort (ms)  : %d\n", bubble_time);
+    printf("Pick next (ms)    : %d\n", pick_time);
+    printf("Score checksums   : %s\n", bubble_sum == pick_sum ? "match" : "differ");
+    fflush(stdout);
 
-    // initialize slider attacks
-    initSliderAttacks(bishop);
-    initSliderAttacks(rook);
-    // initialize zobrist pseudorandom numbers
-    initZobristNums();
-    // initalize magic numbers (not used since magics have been hard coded in)
-    // initMagicNumbers();
+    free(trace);
 }
+#endif
 
 /******************\
 --------------------
@@ -3074,7 +5248,7 @@ move_t parseMove(char *move_string)
     // printf("total move count for move %s : %d\n", move_string, move_list.total_count); //debug line
     for (int i = 0; i < move_list.total_count; i++)
     { // loop through generated moves
-        move = move_list.moves[i];
+        move = getMove(move_list.entries[i]);
         // printMoveUCI(move); //debug line
         flags = getFlags(move);
         // check if source and target squares match the move string
@@ -3214,22 +5388,328 @@ void parseGo(char *input) // a function to parse the "go" command sent by GUI to
     int black_search_time = (btime / 20) + (binc / 2);
 
     int search_time = (side == white) ? white_search_time : black_search_time;
-    startTimer(search_time);
+    int remaining = (side == white) ? wtime : btime;
+    // the soft limit is the planned time, the hard one lets an unstable search overrun it up to 3x, but never past a third of the clock
+    int soft_time = search_time;
+    int hard_time = (remaining / 3 < 3 * search_time) ? remaining / 3 : 3 * search_time;
+    if (hard_time < search_time)
+        hard_time = search_time;
+
+    // "go movetime x" searches for exactly x milliseconds
+    char *movetime_ptr = strstr(input, "movetime");
+    if (movetime_ptr != NULL)
+    {
+        movetime_ptr += 8; // move pointer forward to skip "movetime" text
+        sscanf(movetime_ptr, "%d", &search_time);
+        hard_time = search_time;
+        soft_time = INFINITE_TIME; // use all of it, no early stop
+    }
+    // no clock was sent at all ("go depth x", "go infinite"), so the search is only limited by depth or ended by "stop"
+    else if (wtime_ptr == NULL && btime_ptr == NULL)
+    {
+        hard_time = INFINITE_TIME;
+        soft_time = INFINITE_TIME;
+    }
+
+    // "go depth x" limits iterative deepening to x plies, otherwise the clock, "movetime" or "stop" ends the search
+    int depth = MAX_DEPTH;
+    char *depth_ptr = strstr(input, "depth");
+    if (depth_ptr != NULL)
+    {
+        depth_ptr += 5; // move pointer forward to skip "depth" text
+        sscanf(depth_ptr, "%d", &depth);
+        if (depth < 1)
+            depth = 1;
+        if (depth > MAX_DEPTH)
+            depth = MAX_DEPTH;
+    }
+    // "go searchmoves e2e4 d2d4 ..." only searches the listed moves at the root, the list ends at the first non-move token
+    search_move_count = 0;
+    char *searchmoves_ptr = strstr(input, "searchmoves");
+    if (searchmoves_ptr != NULL)
+    {
+        searchmoves_ptr += 11; // move pointer forward to skip "searchmoves" text
+        while (*searchmoves_ptr == ' ')
+        {
+            searchmoves_ptr++;
+            if (searchmoves_ptr[0] < 'a' || searchmoves_ptr[0] > 'h' || searchmoves_ptr[1] < '1' || searchmoves_ptr[1] > '8' ||
+                searchmoves_ptr[2] < 'a' || searchmoves_ptr[2] > 'h' || searchmoves_ptr[3] < '1' || searchmoves_ptr[3] > '8')
+                break;
+            move_t move = parseMove(searchmoves_ptr);
+            if (move && search_move_count < MAX_MOVES)
+                search_moves[search_move_count++] = move;
+            while (*searchmoves_ptr && *searchmoves_ptr != ' ' && *searchmoves_ptr != '\n')
+                searchmoves_ptr++;
+        }
+    }
+    startTimer(hard_time);
+    soft_time_limit = soft_time;
+
+    uci_search = true;
+    infinite_search = strstr(input, "infinite") != NULL;
+    searchPos(depth);
+    uci_search = false;
+    infinite_search = false;
+}
+
+/*
+"timetest" sends "go movetime" through parseGo() on simple positions and checks that the time, not the depth, ends the
+search : every position has to get past BENCH_DEFAULT_DEPTH, which takes a few milliseconds on any of them, and the
+search has to return within a little more than the movetime. A fixed default depth hiding behind a time limit (the
+search used to stop at depth 5 whatever the clock said) fails the first check, a time check that doesn't stop fails
+the second.
+*/
+#define TIME_TEST_OVERRUN 100 // ms the search may take past the movetime before the test fails
+
+char *time_test_positions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", // start position
+    "8/8/8/8/8/4K3/R7/7k w - - 0 1",                            // king and rook against king
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",               // rook endgame
+};
+
+void timeTest(int movetime)
+{
+    int test_count = sizeof(time_test_positions) / sizeof(time_test_positions[0]);
+    int failed = 0;
+    beginTestSearches(BENCH_DEFAULT_HASH_MB);
+    char command[64];
+    snprintf(command, sizeof(command), "go movetime %d", movetime);
+
+    for (int i = 0; i < test_count; i++)
+    {
+        startTestPosition(time_test_positions[i]);
+        int start = getTime();
+        parseGo(command);
+        int elapsed = getTime() - start;
+        bool passed = completed_depth > BENCH_DEFAULT_DEPTH && elapsed <= movetime + TIME_TEST_OVERRUN;
+        if (!passed)
+        {
+            failed++;
+        }
+        printf("%s : depth %d in %d ms, %s\n", time_test_positions[i], completed_depth, elapsed, passed ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+    printf("\n%d/%d passed\n", test_count - failed, test_count);
+    fflush(stdout);
+
+    endTestSearches();
+}
+
+void parseSetOption(char *input) // a function to parse the "setoption name x value y" command sent by GUI to engine
+{
+    char *value_ptr = strstr(input, "value");
+    if (value_ptr == NULL)
+    {
+        return;
+    }
+    value_ptr += 5; // move pointer forward to skip "value" text
+
+    if (strstr(input, "name Hash") != NULL)
+    {
+        int megabytes = DEFAULT_HASH_MB;
+        sscanf(value_ptr, "%d", &megabytes);
+        if (megabytes < 1)
+            megabytes = 1;
+        if (megabytes > MAX_HASH_MB)
+            megabytes = MAX_HASH_MB;
+        hash_megabytes = megabytes;
+        setupTT();
+        printTTInfo();
+    }
+    // "setoption name SharedHash value <name>" maps the table from shared memory, "<empty>" goes back to a table of our own
+    else if (strstr(input, "name SharedHash") != NULL)
+    {
+        char name[200] = "";
+        sscanf(value_ptr, "%199s", name);
+        if (name[0] == '\0' || strcmp(name, "<empty>") == 0)
+            shared_hash_name[0] = '\0';
+        else // POSIX shared memory names start with a slash
+            snprintf(shared_hash_name, sizeof(shared_hash_name), "%s%s", name[0] == '/' ? "" : "/", name);
+        setupTT();
+        printTTInfo();
+    }
+    else if (strstr(input, "name MultiPV") != NULL)
+    {
+        sscanf(value_ptr, "%d", &multi_pv);
+        if (multi_pv < 1)
+            multi_pv = 1;
+        if (multi_pv > MAX_MULTI_PV)
+            multi_pv = MAX_MULTI_PV;
+    }
+    else if (strstr(input, "name UsePEXT") != NULL)
+    {
+        // only turn the pext backend on when the CPU supports it, turning it off falls back to magic bitboards
+        use_pext = pext_available && strncmp(value_ptr, " true", 5) == 0;
+        printf("info string slider attacks use %s\n", use_pext ? "pext" : "magic bitboards");
+        fflush(stdout);
+    }
+    else
+    {
+        for (int i = 0; i < TUNABLE_COUNT; i++)
+        {
+            char option_name[64];
+            snprintf(option_name, sizeof(option_name), "name %s ", tunables[i].name); // trailing space so no name matches a longer one
+            if (strstr(input, option_name) != NULL)
+            {
+                int value = *tunables[i].value;
+                sscanf(value_ptr, "%d", &value);
+                if (value < tunables[i].min)
+                    value = tunables[i].min;
+                if (value > tunables[i].max)
+                    value = tunables[i].max;
+                *tunables[i].value = value;
+                break;
+            }
+        }
+    }
+}
+
+void printEngineInfo() // reply to the "uci" command with engine name, supported options, then "uciok"
+{
+    printf("id name Superjelly\n");
+    printf("option name Hash type spin default %d min 1 max %d\n", DEFAULT_HASH_MB, MAX_HASH_MB);
+    printf("option name SharedHash type string default <empty>\n");
+    printf("option name MultiPV type spin default 1 min 1 max %d\n", MAX_MULTI_PV);
+    printf("option name UsePEXT type check default %s\n", pext_available ? "true" : "false");
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+    {
+        printf("option name %s type spin default %d min %d max %d\n", tunables[i].name, tunables[i].default_value, tunables[i].min, tunables[i].max);
+    }
+    printf("uciok\n");
+    fflush(stdout);
+}
+
+/*
+handle one command, either a line read by uciLoop() or the command line arguments joined by main().
+returns 0 if the engine should quit, 1 otherwise.
+*/
+int parseCommand(char *buffer)
+{
+    /*
+    the next command sent to the engine after "uci" will be "isready", to which our engine must reply with "readyok".
+     */
+    if (strncmp(buffer, "isready", 7) == 0)
+    {
+        static bool tt_info_printed = false; // the table of initEverything() is reported once, the Hash and SharedHash options report the others
+        if (!tt_info_printed)
+        {
+            printTTInfo();
+            tt_info_printed = true;
+        }
+        printf("readyok\n");
+        fflush(stdout);
+    }
+
+    // handle "quit" cmd by ending loop
+    else if (strncmp(buffer, "quit", 4) == 0)
+    {
+        return 0;
+    }
+    // handle "ucinewgame" command by resetting board to starting position
+    else if (strncmp(buffer, "ucinewgame", 10) == 0)
+    {
+        initFENPosition(starting_postition_fen);
+        clearHistory();
+    }
+    // handle "position" command by setting up position sent by GUI
+    else if (strncmp(buffer, "position", 8) == 0)
+    {
+        parsePosition(buffer);
+    }
+    // handle "go" command by starting search for best move
+    else if (strncmp(buffer, "go", 2) == 0)
+    {
+        parseGo(buffer);
+    }
+    // handle "setoption" command by changing the option sent by GUI
+    else if (strncmp(buffer, "setoption", 9) == 0)
+    {
+        parseSetOption(buffer);
+    }
+    // handle "perftsuite [threads] [hash]" by running the perft positions with known node counts
+    else if (strncmp(buffer, "perftsuite", 10) == 0)
+    {
+        int threads = 1;
+        int hash_mb = 0;
+        sscanf(buffer + 10, "%d %d", &threads, &hash_mb); // move pointer forward to skip "perftsuite" text
+        initPerftHash(hash_mb);
+        perftSuite(threads);
+    }
+    // handle "perft <depth> [threads] [hash]" by counting the leaf nodes of the current position
+    else if (strncmp(buffer, "perft", 5) == 0)
+    {
+        parsePerft(buffer + 5, false); // move pointer forward to skip "perft" text
+    }
+    // handle "divide <depth> [threads] [hash]" by running perft with node counts for every root move
+    else if (strncmp(buffer, "divide", 6) == 0)
+    {
+        parsePerft(buffer + 6, true); // move pointer forward to skip "divide" text
+    }
+    // handle "savehash <file>" by writing the transposition table to a file
+    else if (strncmp(buffer, "savehash", 8) == 0)
+    {
+        char file_name[1000];
+        if (sscanf(buffer + 8, "%999s", file_name) == 1) // move pointer forward to skip "savehash" text
+            saveHash(file_name);
+        fflush(stdout);
+    }
+    // handle "loadhash <file>" by mapping a table written by "savehash"
+    else if (strncmp(buffer, "loadhash", 8) == 0)
+    {
+        char file_name[1000];
+        if (sscanf(buffer + 8, "%999s", file_name) == 1) // move pointer forward to skip "loadhash" text
+            loadHash(file_name);
+        fflush(stdout);
+    }
+    // handle "gentables" by printing the precomputed tables as C source
+    else if (strncmp(buffer, "gentables", 9) == 0)
+    {
+        printTables();
+    }
+    // handle "bench [depth] [threads] [hash]" by running the bench positions
+    else if (strncmp(buffer, "bench", 5) == 0)
+    {
+        parseBench(buffer);
+    }
+    // handle "matesuite" by searching the positions with a known forced mate
+    else if (strncmp(buffer, "matesuite", 9) == 0)
+    {
+        mateSuite();
+    }
+    // handle "timetest [movetime]" by checking that "go movetime" searches past the bench depth and stops on time
+    else if (strncmp(buffer, "timetest", 8) == 0)
+    {
+        int movetime = TIME_TEST_MOVETIME;
+        sscanf(buffer + 8, "%d", &movetime); // move pointer forward to skip "timetest" text
+        timeTest(movetime < 1 ? 1 : movetime);
+    }
+#ifdef SORT_TRACE
+    // handle "sortbench [depth]" by replaying traced move lists through both move sorting strategies
+    else if (strncmp(buffer, "sortbench", 9) == 0)
+    {
+        int depth = BENCH_DEFAULT_DEPTH;
+        sscanf(buffer + 9, "%d", &depth); // move pointer forward to skip "sortbench" text
+        sortBench(depth < 1 ? 1 : (depth > MAX_DEPTH ? MAX_DEPTH : depth));
+    }
+#endif
 
-    searchPos();
+    // provide info requested by "uci" command
+    else if (strncmp(buffer, "uci", 3) == 0)
+    {
+        printEngineInfo();
+    }
+    return 1;
 }
 
 void uciLoop()
 {
     // reset input and output buffers
     setbuf(stdout, NULL);
-    // setbuf(stdin, NULL);
+    setbuf(stdin, NULL); // unbuffered, so checkStop() can see with select() whether a "stop" is waiting
     // create buffer for input
     char buffer[2000];
     // send GUI info about engine and "uciok" command to begin UCI communcation
-    printf("id name Superjelly\n");
-    printf("uciok\n");
-    fflush(stdout);
+    printEngineInfo();
     while (1)
     {
 
@@ -3244,45 +5724,16 @@ void uciLoop()
         {
             continue;
         }
-        /*
-        the next command sent to the engine after "uci" will be "isready", to which our engine must reply with "readyok".
-         */
-        if (strncmp(buffer, "isready", 7) == 0)
+        bool keep_going = parseCommand(buffer) && !quit_requested;
+        // then whatever the GUI sent during that command's search, which may itself be a "go" queuing more
+        while (keep_going && nextPendingCommand(buffer))
         {
-            printf("readyok\n");
-            fflush(stdout);
-            continue;
+            keep_going = parseCommand(buffer) && !quit_requested;
         }
-
-        // handle "quit" cmd by ending loop
-        else if (strncmp(buffer, "quit", 4) == 0)
+        if (!keep_going)
         {
             break;
         }
-        // handle "ucinewgame" command by resetting board to starting position
-        else if (strncmp(buffer, "ucinewgame", 10) == 0)
-        {
-            initFENPosition(starting_postition_fen);
-        }
-        // handle "position" command by setting up position sent by GUI
-        else if (strncmp(buffer, "position", 8) == 0)
-        {
-            parsePosition(buffer);
-        }
-        // handle "go" command by starting search for best move
-        else if (strncmp(buffer, "go", 2) == 0)
-        {
-            parseGo(buffer);
-        }
-
-        // provide info requested by "uci" command
-        else if (strncmp(buffer, "uci", 3) == 0)
-        {
-
-            printf("id name Superjelly\n");
-            printf("uciok\n");
-            fflush(stdout);
-        }
     }
 }
 
@@ -3292,7 +5743,7 @@ void uciLoop()
 --------------------
 \******************/
 
-int main() // entry point
+int main(int argc, char *argv[]) // entry point
 {
 
     initEverything();
@@ -3302,7 +5753,18 @@ int main() // entry point
 
         initFENPosition(FEN_test_3);
         printBoard();
-        searchPos();
+        startTimer(INFINITE_TIME);
+        searchPos(5);
+    }
+    else if (argc > 1) // run a single command given on the command line, for example "superjelly.exe bench 6"
+    {
+        char buffer[2000] = "";
+        for (int i = 1; i < argc; i++)
+        {
+            strncat(buffer, argv[i], sizeof(buffer) - strlen(buffer) - 2);
+            strcat(buffer, " ");
+        }
+        parseCommand(buffer);
     }
     else
     {